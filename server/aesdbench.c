@@ -0,0 +1,594 @@
+/**
+ * @file aesdbench.c
+ * @brief Load generator and latency benchmark for aesdsocket
+ *
+ * Opens N connections, each on its own thread, and sends packets of a given
+ * size, optionally at a fixed rate. Every packet starts with a token unique
+ * to its connection and sequence number; an operation completes when the
+ * line carrying its token comes back, wherever it sits in the reply. By
+ * default connections switch to AESDCHAR_DELTA so replies stay small, and
+ * with -b they go on in binary mode (binproto.h). With -d each connection
+ * pipelines that many packets before waiting for the last one's reply. The
+ * result is printed as one JSON object on stdout.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <endian.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "binproto.h"
+
+const static char kDefaultHost[] = "127.0.0.1";
+const static int kDefaultPort = 9000;
+const static int kDefaultConnections = 4;
+const static int kDefaultPackets = 1000;
+const static int kDefaultPacketLength = 64;
+const static int kDefaultDepth = 1;
+const static char kDeltaCmd[] = "AESDCHAR_DELTA:1\n";
+const static char kSeekCmd[] = "AESDCHAR_IOCSEEKTO:0,0\n";
+const static size_t kReceiveLength = 65536;
+
+#define BENCH_TOKEN_LENGTH 32
+
+typedef struct benchOptions
+{
+  struct sockaddr_in addr;
+  int connections;
+  int packets;
+  int packetLength;
+  /**
+   * Packets per second per connection, 0 to send as fast as replies come
+   */
+  double rate;
+  /**
+   * Every seekEvery-th operation is a seek to the start followed by the
+   * packet, 0 for none
+   */
+  int seekEvery;
+  /**
+   * Packets sent back to back before waiting for replies
+   */
+  int depth;
+  bool delta;
+  bool binary;
+}benchOptions_t;
+
+typedef struct benchConnection
+{
+  int id;
+  pthread_t thread;
+  const benchOptions_t *options;
+  pthread_barrier_t *start;
+  uint64_t *latencies;
+  int completed;
+  int seeks;
+  uint64_t bytesSent;
+  uint64_t bytesReceived;
+  int error;
+  /**
+   * Start of the line being received, enough to hold a token
+   */
+  char line[BENCH_TOKEN_LENGTH];
+  size_t lineLength;
+  /**
+   * Binary mode: the frame header being received and how much of the
+   * payload it announced is still to come
+   */
+  bool framed;
+  binprotoHeader_t header;
+  size_t headerLength;
+  uint64_t payloadRemaining;
+}benchConnection_t;
+
+static uint64_t now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleepUntil(uint64_t deadline)
+{
+  struct timespec ts;
+
+  ts.tv_sec = deadline / 1000000000ULL;
+  ts.tv_nsec = deadline % 1000000000ULL;
+
+  while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static bool sendAll(benchConnection_t *conn, int fd, const char *data, size_t length)
+{
+  ssize_t bytesSent;
+
+  while(length > 0)
+  {
+    bytesSent = send(fd, data, length, MSG_NOSIGNAL);
+
+    if(bytesSent == -1)
+    {
+      if(errno == EINTR)
+      {
+        continue;
+      }
+
+      return false;
+    }
+
+    conn->bytesSent += bytesSent;
+    data += bytesSent;
+    length -= bytesSent;
+  }
+
+  return true;
+}
+
+/**
+ * Sends @param length bytes of @param packet, as an append frame in binary
+ * mode; the frame header goes in the sizeof(binprotoHeader_t) bytes
+ * reserved in front of it
+ */
+static bool sendPacket(benchConnection_t *conn, int fd, char *packet, size_t length)
+{
+  binprotoHeader_t header;
+
+  if(!conn->framed)
+  {
+    return sendAll(conn, fd, packet, length);
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.opcode = BINPROTO_APPEND;
+  header.length = htobe64(length);
+  memcpy(packet - sizeof(header), &header, sizeof(header));
+
+  return sendAll(conn, fd, packet - sizeof(header), length + sizeof(header));
+}
+
+/**
+ * Switches the connection to delta mode, with a frame in binary mode
+ */
+static bool sendDelta(benchConnection_t *conn, int fd)
+{
+  char frame[sizeof(binprotoHeader_t) + 1];
+  binprotoHeader_t header;
+
+  if(!conn->framed)
+  {
+    return sendAll(conn, fd, kDeltaCmd, strlen(kDeltaCmd));
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.opcode = BINPROTO_DELTA;
+  header.length = htobe64(1);
+  memcpy(frame, &header, sizeof(header));
+  frame[sizeof(header)] = 1;
+
+  return sendAll(conn, fd, frame, sizeof(frame));
+}
+
+/**
+ * Sends the seek to the start of the store, as a frame in binary mode
+ */
+static bool sendSeek(benchConnection_t *conn, int fd)
+{
+  char frame[sizeof(binprotoHeader_t) + 2 * sizeof(uint32_t)];
+  binprotoHeader_t header;
+
+  if(!conn->framed)
+  {
+    return sendAll(conn, fd, kSeekCmd, strlen(kSeekCmd));
+  }
+
+  memset(frame, 0, sizeof(frame));
+  memset(&header, 0, sizeof(header));
+  header.opcode = BINPROTO_SEEKTO;
+  header.length = htobe64(sizeof(frame) - sizeof(header));
+  memcpy(frame, &header, sizeof(header));
+
+  return sendAll(conn, fd, frame, sizeof(frame));
+}
+
+/**
+ * Reads replies until a line starting with @param token has been received.
+ * Lines are only compared on their first BENCH_TOKEN_LENGTH bytes, the rest
+ * is skipped as it streams past. In binary mode frame headers are taken out
+ * of the stream first.
+ */
+static bool awaitToken(benchConnection_t *conn, int fd, char *buffer, const char *token, size_t tokenLength)
+{
+  ssize_t bytesRecv;
+  ssize_t i;
+  bool found = false;
+
+  while(!found)
+  {
+    bytesRecv = recv(fd, buffer, kReceiveLength, 0);
+
+    if(bytesRecv == -1 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if(bytesRecv <= 0)
+    {
+      return false;
+    }
+
+    conn->bytesReceived += bytesRecv;
+
+    for(i = 0; i < bytesRecv; i++)
+    {
+      if(conn->framed && conn->payloadRemaining == 0)
+      {
+        ((char *)&conn->header)[conn->headerLength++] = buffer[i];
+
+        if(conn->headerLength == sizeof(conn->header))
+        {
+          conn->payloadRemaining = be64toh(conn->header.length);
+          conn->headerLength = 0;
+        }
+
+        continue;
+      }
+
+      conn->payloadRemaining -= conn->framed ? 1 : 0;
+
+      if(buffer[i] == '\n')
+      {
+        found = found || (conn->lineLength >= tokenLength && memcmp(conn->line, token, tokenLength) == 0);
+        conn->lineLength = 0;
+      }
+      else if(conn->lineLength < BENCH_TOKEN_LENGTH)
+      {
+        conn->line[conn->lineLength++] = buffer[i];
+      }
+    }
+  }
+
+  return true;
+}
+
+static void *runConnection(void *threadParam)
+{
+  benchConnection_t *conn = (benchConnection_t *)threadParam;
+  const benchOptions_t *options = conn->options;
+  char *frame = NULL;
+  char *packet = NULL;
+  char *buffer = NULL;
+  binprotoHeader_t hello;
+  ssize_t bytesRecv;
+  size_t helloLength = 0;
+  char token[BENCH_TOKEN_LENGTH];
+  size_t tokenLength;
+  uint64_t interval = (options->rate > 0) ? (uint64_t)(1e9 / options->rate) : 0;
+  uint64_t scheduled;
+  uint64_t started;
+  const int one = 1;
+  int fd = -1;
+  int batch;
+  int i;
+  int j;
+
+  // Room for a frame header in front of the packet
+  frame = malloc(sizeof(binprotoHeader_t) + options->packetLength);
+  packet = (frame != NULL) ? frame + sizeof(binprotoHeader_t) : NULL;
+  buffer = malloc(kReceiveLength);
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  if(packet == NULL || buffer == NULL || fd == -1 || connect(fd, (const struct sockaddr *)&options->addr, sizeof(options->addr)) != 0)
+  {
+    conn->error = errno;
+    pthread_barrier_wait(conn->start);
+    goto done;
+  }
+
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  // Nothing else is in flight yet, so the hello is the first thing back
+  if(options->binary && !sendAll(conn, fd, BINPROTO_HANDSHAKE, strlen(BINPROTO_HANDSHAKE)))
+  {
+    conn->error = errno;
+  }
+
+  while(conn->error == 0 && options->binary && helloLength < sizeof(hello))
+  {
+    bytesRecv = recv(fd, (char *)&hello + helloLength, sizeof(hello) - helloLength, 0);
+
+    if(bytesRecv <= 0 && !(bytesRecv == -1 && errno == EINTR))
+    {
+      conn->error = (bytesRecv == 0) ? EPIPE : errno;
+    }
+
+    helloLength += (bytesRecv > 0) ? bytesRecv : 0;
+  }
+
+  conn->framed = options->binary;
+
+  // The mode switch replies with everything not seen yet, i.e. the store as
+  // it is now; sync up on a first packet before the clock starts
+  if(options->delta && conn->error == 0 && !sendDelta(conn, fd))
+  {
+    conn->error = errno;
+  }
+
+  tokenLength = snprintf(token, sizeof(token), "bench %d start ", conn->id);
+  memset(packet, 'x', options->packetLength);
+  memcpy(packet, token, tokenLength);
+  packet[options->packetLength - 1] = '\n';
+
+  if(conn->error == 0 && (!sendPacket(conn, fd, packet, options->packetLength) || !awaitToken(conn, fd, buffer, token, tokenLength)))
+  {
+    conn->error = errno ? errno : EPIPE;
+  }
+
+  conn->bytesSent = 0;
+  conn->bytesReceived = 0;
+
+  pthread_barrier_wait(conn->start);
+  scheduled = now();
+
+  for(i = 0; i < options->packets && conn->error == 0; i += batch)
+  {
+    batch = (options->packets - i < options->depth) ? options->packets - i : options->depth;
+
+    if(interval > 0)
+    {
+      sleepUntil(scheduled);
+    }
+
+    // With a fixed rate latency counts from when the packet was due, so a
+    // slow reply isn't hidden by the packets it delayed
+    started = (interval > 0) ? scheduled : now();
+
+    for(j = 0; j < batch && conn->error == 0; j++)
+    {
+      tokenLength = snprintf(token, sizeof(token), "bench %d %d ", conn->id, i + j);
+      memset(packet, 'x', options->packetLength);
+      memcpy(packet, token, tokenLength);
+      packet[options->packetLength - 1] = '\n';
+
+      if(options->seekEvery > 0 && (i + j) % options->seekEvery == options->seekEvery - 1)
+      {
+        if(!sendSeek(conn, fd))
+        {
+          conn->error = errno;
+          break;
+        }
+
+        conn->seeks++;
+      }
+
+      if(!sendPacket(conn, fd, packet, options->packetLength))
+      {
+        conn->error = errno ? errno : EPIPE;
+      }
+    }
+
+    // Replies come back in order, so the last token covers the whole batch
+    if(conn->error == 0 && !awaitToken(conn, fd, buffer, token, tokenLength))
+    {
+      conn->error = errno ? errno : EPIPE;
+    }
+
+    for(j = 0; j < batch && conn->error == 0; j++)
+    {
+      conn->latencies[conn->completed++] = now() - started;
+    }
+
+    scheduled += interval * batch;
+  }
+
+done:
+  if(fd != -1)
+  {
+    close(fd);
+  }
+
+  free(buffer);
+  free(frame);
+
+  return NULL;
+}
+
+static int compareLatency(const void *a, const void *b)
+{
+  uint64_t left = *(const uint64_t *)a;
+  uint64_t right = *(const uint64_t *)b;
+
+  return (left > right) - (left < right);
+}
+
+static double percentile(const uint64_t *sorted, size_t count, double fraction)
+{
+  size_t index = (size_t)(fraction * count);
+
+  if(count == 0)
+  {
+    return 0;
+  }
+
+  return sorted[(index < count) ? index : count - 1] / 1000.0;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "Usage: %s [-H host] [-p port] [-c connections] [-n packets] [-s size] [-r rate] [-k seek-every] [-d depth] [-f] [-b]\n", name);
+  fprintf(stderr, "  -H  server address (default %s)\n", kDefaultHost);
+  fprintf(stderr, "  -p  server port (default %d)\n", kDefaultPort);
+  fprintf(stderr, "  -c  concurrent connections (default %d)\n", kDefaultConnections);
+  fprintf(stderr, "  -n  packets per connection (default %d)\n", kDefaultPackets);
+  fprintf(stderr, "  -s  packet size in bytes including the newline (default %d)\n", kDefaultPacketLength);
+  fprintf(stderr, "  -r  packets per second per connection, 0 for as fast as possible (default 0)\n");
+  fprintf(stderr, "  -k  precede every k-th packet with AESDCHAR_IOCSEEKTO:0,0 (default never)\n");
+  fprintf(stderr, "  -d  packets pipelined before waiting for their replies (default %d)\n", kDefaultDepth);
+  fprintf(stderr, "  -f  keep full-history replies instead of switching to AESDCHAR_DELTA\n");
+  fprintf(stderr, "  -b  send length-prefixed frames after the AESDCHAR_BINARY handshake\n");
+}
+
+int main(int argc, char *argv[])
+{
+  benchOptions_t options;
+  benchConnection_t *conns = NULL;
+  pthread_barrier_t start;
+  const char *host = kDefaultHost;
+  int port = kDefaultPort;
+  struct addrinfo hints;
+  struct addrinfo *resolved = NULL;
+  uint64_t *latencies = NULL;
+  uint64_t bytesSent = 0;
+  uint64_t bytesReceived = 0;
+  uint64_t began;
+  double seconds;
+  size_t count = 0;
+  int seeks = 0;
+  int errors = 0;
+  int opt;
+  int i;
+
+  memset(&options, 0, sizeof(options));
+  options.connections = kDefaultConnections;
+  options.packets = kDefaultPackets;
+  options.packetLength = kDefaultPacketLength;
+  options.depth = kDefaultDepth;
+  options.delta = true;
+
+  while((opt = getopt(argc, argv, "H:p:c:n:s:r:k:d:fb")) != -1)
+  {
+    switch(opt)
+    {
+    case 'H':
+      host = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'c':
+      options.connections = atoi(optarg);
+      break;
+    case 'n':
+      options.packets = atoi(optarg);
+      break;
+    case 's':
+      options.packetLength = atoi(optarg);
+      break;
+    case 'r':
+      options.rate = atof(optarg);
+      break;
+    case 'k':
+      options.seekEvery = atoi(optarg);
+      break;
+    case 'd':
+      options.depth = atoi(optarg);
+      break;
+    case 'f':
+      options.delta = false;
+      break;
+    case 'b':
+      options.binary = true;
+      break;
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // The token has to fit in front of the newline
+  if(options.connections <= 0 || options.packets < 0 || options.packetLength < BENCH_TOKEN_LENGTH || options.rate < 0 || options.seekEvery < 0 || options.depth <= 0)
+  {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if(getaddrinfo(host, NULL, &hints, &resolved) != 0)
+  {
+    fprintf(stderr, "cannot resolve %s\n", host);
+    exit(EXIT_FAILURE);
+  }
+
+  options.addr = *(struct sockaddr_in *)resolved->ai_addr;
+  options.addr.sin_port = htons(port);
+  freeaddrinfo(resolved);
+
+  conns = calloc(options.connections, sizeof(benchConnection_t));
+  latencies = calloc((size_t)options.connections * options.packets + 1, sizeof(uint64_t));
+
+  if(conns == NULL || latencies == NULL)
+  {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  pthread_barrier_init(&start, NULL, options.connections + 1);
+
+  for(i = 0; i < options.connections; i++)
+  {
+    conns[i].id = i;
+    conns[i].options = &options;
+    conns[i].start = &start;
+    conns[i].latencies = latencies + (size_t)i * options.packets;
+
+    if(pthread_create(&conns[i].thread, NULL, runConnection, &conns[i]) != 0)
+    {
+      fprintf(stderr, "pthread_create() failed\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  pthread_barrier_wait(&start);
+  began = now();
+
+  for(i = 0; i < options.connections; i++)
+  {
+    pthread_join(conns[i].thread, NULL);
+  }
+
+  seconds = (now() - began) / 1e9;
+  pthread_barrier_destroy(&start);
+
+  // Gather every connection's latencies at the front of the array
+  for(i = 0; i < options.connections; i++)
+  {
+    memmove(latencies + count, conns[i].latencies, conns[i].completed * sizeof(uint64_t));
+    count += conns[i].completed;
+    bytesSent += conns[i].bytesSent;
+    bytesReceived += conns[i].bytesReceived;
+    seeks += conns[i].seeks;
+    errors += (conns[i].error != 0);
+  }
+
+  qsort(latencies, count, sizeof(uint64_t), compareLatency);
+
+  printf("{\"connections\": %d, \"packet_size\": %d, \"operations\": %zu, \"seeks\": %d, \"errors\": %d, "
+      "\"seconds\": %.6f, \"ops_per_sec\": %.1f, \"tx_mb_per_sec\": %.3f, \"rx_mb_per_sec\": %.3f, "
+      "\"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}}\n",
+      options.connections, options.packetLength, count, seeks, errors,
+      seconds, (seconds > 0) ? count / seconds : 0,
+      (seconds > 0) ? bytesSent / seconds / 1e6 : 0, (seconds > 0) ? bytesReceived / seconds / 1e6 : 0,
+      percentile(latencies, count, 0.5), percentile(latencies, count, 0.99), percentile(latencies, count, 0.999),
+      (count > 0) ? latencies[count - 1] / 1000.0 : 0);
+
+  free(latencies);
+  free(conns);
+
+  return (errors > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
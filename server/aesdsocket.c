@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,6 +7,7 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <syslog.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -13,292 +15,2752 @@
 #include <stdbool.h>
 #include <signal.h>
 #include <pthread.h>
-#include <sys/time.h>
 #include <time.h>
+#include <stdatomic.h>
+#include <endian.h>
 #include "queue.h"
+#include "workqueue.h"
+#include "framer.h"
+#include "bufpool.h"
+#include "store.h"
+#include "logcache.h"
+#include "logring.h"
+#include "stats.h"
+#include "uring.h"
+#include "binproto.h"
 #include "../aesd-char-driver/aesd_ioctl.h"
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <poll.h>
 
-#define USE_AESD_CHAR_DEVICE 1
+const static int kPort = 9000;
+const char kIOCtrlStr[] = "AESDCHAR_IOCSEEKTO:";
+const static char kDeltaStr[] = "AESDCHAR_DELTA:";
+const static char kReadStr[] = "AESDCHAR_READ:";
+const static char kSubscribeStr[] = "AESDCHAR_SUBSCRIBE:";
+const static char kStatsStr[] = "AESDCHAR_STATS:";
+const static char kBinaryStr[] = "AESDCHAR_BINARY:";
+const static int kBufferStartLength = BUFPOOL_MIN_SIZE;
+const static size_t kStatsReplyLength = 4096;
+const static int kMaxEvents = 64;
+const static int kDefaultWorkers = 4;
+const static int kMaxReactors = 64;
+const static int kWorkQueueLength = 1024;
+const static int kMaxFreeConnections = 64;
+const static int kTimestampInterval = 10;
+// Packets that grow past this are written to the store as they arrive
+const static size_t kStreamChunkLength = 64 * 1024;
+// Seconds between checks that a streamed packet is still arriving; a client
+// that sends nothing of it for a whole interval loses its connection
+const static int kStreamIdleInterval = 5;
+// Binary mode: longest payload of anything but an append
+const static uint64_t kMaxCommandPayload = 64;
+// Default cap on the connections' buffers together, see -m
+const static size_t kDefaultBufferBudget = 64 * 1024 * 1024;
+// Subscribers further than this behind the committed end are dropped
+const static off_t kMaxSubscriberLag = 4 * 1024 * 1024;
+// Submission queue and registered file table size of each io_uring reactor
+const static unsigned int kUringEntries = 256;
+const static unsigned int kUringFiles = 1024;
+// Completion tags kept in the low bits of the connection pointer; the
+// reactor's own poll on its epoll set completes with kUringEvents alone
+const static uint64_t kUringEvents = 0;
+const static uint64_t kUringRecv = 1;
+const static uint64_t kUringSend = 2;
+const static uint64_t kUringPoll = 3;
+const static uint64_t kUringTagMask = 3;
+// Appends a connection can have buffered and submitted at once, and responses
+// it can have queued behind the one being sent
+#define MAX_PIPELINED 32
+// Passed to connectionRespond() to start where the connection's mode says
+const static off_t kFromCursor = -1;
+// Passed to connectionRespond() to send up to the end of the store
+const static off_t kToEnd = -1;
+
+// All but the char backend: expires every kTimestampInterval seconds, serviced by the
+// first reactor
+static int timerFd = -1;
+
+struct reactor;
+
+/**
+ * One of the appends submitted together for packets a client pipelined,
+ * see appendPacket()
+ */
+typedef struct pipelined
+{
+  storeRequest_t request;
+  uint32_t tag;
+}pipelined_t;
+
+/**
+ * A response waiting behind the one being sent, as logical positions
+ */
+typedef struct response
+{
+  off_t start;
+  off_t end;
+  binprotoHeader_t header;
+  uint64_t sendStart;
+  storePin_t *pin;
+}response_t;
+
+/**
+ * Per client state. The socket is always non-blocking; in reactor mode the
+ * reactor that accepted it services it directly, in worker mode the reactor
+ * hands it to the pool and it stays disarmed (EPOLLONESHOT) until the worker
+ * is done. Contexts are recycled through a free list rather than freed.
+ */
+typedef struct connection
+{
+  int cfd;
+  struct reactor *reactor;
+  struct in_addr clientAddr;
+  framer_t framer;
+  bool sending;
+  off_t sendOffset;
+  off_t sendEnd;
+  /**
+   * Logical position of store offset 0 for the response being sent
+   */
+  off_t sendBase;
+  logcacheView_t view;
+  /**
+   * Keeps what the response being sent from the store still needs from
+   * being dropped between its sendfile() calls, see storePin()
+   */
+  storePin_t *pin;
+  /**
+   * Responses to pipelined packets, sent in order once the current one is
+   * out: together with it in one sendmsg() from the cached view, or under
+   * TCP_CORK (corked) from the store
+   */
+  response_t queued[MAX_PIPELINED];
+  int queuedNext;
+  int queuedCount;
+  bool corked;
+  struct msghdr message;
+  struct iovec iov[2 * MAX_PIPELINED + 3];
+  /**
+   * Appends waiting to be committed, in the order their packets arrived
+   */
+  pipelined_t pipeline[MAX_PIPELINED];
+  int pipelined;
+  bool committing;
+  /**
+   * Delta mode: responses start at cursor, the logical end of the previous
+   * response, instead of at the beginning of the store
+   */
+  bool delta;
+  off_t cursor;
+  /**
+   * Subscribers are pushed everything committed past their cursor and
+   * ignore what they receive. Only their reactor's thread services them.
+   */
+  bool subscribed;
+  /**
+   * Reactor mode: the connection holds the store's append reservation and
+   * has written the start of the packet being received, see storeReserve()
+   */
+  bool streaming;
+  /**
+   * Cleared by every recv, set by the reactor's stream timer, see
+   * streamCheck()
+   */
+  bool streamIdle;
+  /**
+   * Binary mode (binproto.h): frames replace lines. The header of the
+   * current response goes out ahead of everything else; frameRemaining
+   * counts the payload of a streamed append still to come.
+   */
+  bool binary;
+  binprotoHeader_t header;
+  size_t headerOffset;
+  size_t headerLength;
+  uint8_t frameOpcode;
+  uint32_t frameTag;
+  uint64_t frameRemaining;
+  /**
+   * Generated reply (from the buffer pool) sent ahead of any store data
+   */
+  char *reply;
+  size_t replySize;
+  size_t replyLength;
+  size_t replyOffset;
+  /**
+   * statsNow() when the first byte of the packet being received arrived and
+   * when the current response was started, for the latency histograms
+   */
+  uint64_t frameStart;
+  uint64_t sendStart;
+  /**
+   * io_uring reactors: the registered file slot (or -1), how many
+   * operations are in flight and which. A connection being closed waits
+   * for the last of them before its buffers are recycled.
+   */
+  int file;
+  int inflight;
+  bool recvQueued;
+  bool sendQueued;
+  bool pollQueued;
+  bool closing;
+  LIST_ENTRY(connection) entries;
+  STAILQ_ENTRY(connection) commitEntries;
+  LIST_ENTRY(connection) subscriberEntries;
+  /**
+   * Set once the reactor has decided to close the connection while events
+   * for it may still be waiting in the batch it is handling, see
+   * connectionClose()
+   */
+  bool closePending;
+  LIST_ENTRY(connection) closeEntries;
+}connection_t;
+
+STAILQ_HEAD(commithead, connection);
+LIST_HEAD(subscriberhead, connection);
+LIST_HEAD(closehead, connection);
+
+/**
+ * An event loop with its own listening socket and epoll set. With several
+ * reactors every one binds port 9000 with SO_REUSEPORT, so the kernel
+ * spreads new connections across them, and runs pinned to its own CPU.
+ * Reactor 0 runs on the main thread.
+ */
+typedef struct reactor
+{
+  int sfd;
+  int efd;
+  /**
+   * Signalled after every commit while the reactor has subscribers, and to
+   * hand it subscribers or stop it
+   */
+  int notifyFd;
+  int cpu;
+  pthread_t thread;
+  /**
+   * Reactor mode only: connections whose packets are queued for the next
+   * group commit, which runs once every ready connection has been serviced
+   */
+  struct commithead commitWaiters;
+  /**
+   * Subscribers owned by this reactor, and the ones pool workers have handed
+   * over since it last woke up (protected by connectionsMutex)
+   */
+  struct subscriberhead subscribers;
+  struct subscriberhead pendingSubscribers;
+  /**
+   * Connections closed while handling the current batch of events, destroyed
+   * once it is done, see reactorReap()
+   */
+  struct closehead closed;
+  atomic_int subscriberCount;
+  /**
+   * Set while commitWaiters may hold requests queued behind a streamed
+   * packet, so the commit that ends it wakes the reactor
+   */
+  atomic_bool commitParked;
+  /**
+   * Reactor mode: the connection of the reactor that holds the store's
+   * append reservation, if any, and the timer that runs while it does
+   */
+  struct connection *streamer;
+  int streamTimerFd;
+  /**
+   * Set up by the reactor's own thread when io_uring is enabled and
+   * available. Its connections then stay out of the epoll set, which only
+   * keeps the listen socket, notifyFd and the timer, and recv and send are
+   * submitted to the ring instead.
+   */
+  uring_t *ring;
+}reactor_t;
+
+volatile sig_atomic_t gracefullyExit = false;
+
+// Active connections and the free list are shared by the reactors and the
+// workers, both are protected by connectionsMutex.
+pthread_mutex_t connectionsMutex = PTHREAD_MUTEX_INITIALIZER;
+LIST_HEAD(connectionhead, connection) connections = LIST_HEAD_INITIALIZER(connections);
+LIST_HEAD(freehead, connection) freeConnections = LIST_HEAD_INITIALIZER(freeConnections);
+static int freeConnectionCount = 0;
+
+static reactor_t *reactors = NULL;
+static int reactorCount = 0;
+static bool useUring = false;
+
+static workqueue_t workQueue;
+static pthread_t *workers = NULL;
+static int workerCount = 0;
+
+/**
+ * Takes a context from the free list (or allocates one) and registers it as
+ * an active connection.
+ */
+connection_t *connectionCreate(reactor_t *reactor, int cfd, struct in_addr clientAddr)
+{
+  connection_t *conn = NULL;
+
+  pthread_mutex_lock(&connectionsMutex);
+  conn = LIST_FIRST(&freeConnections);
+
+  if(conn != NULL)
+  {
+    LIST_REMOVE(conn, entries);
+    freeConnectionCount--;
+  }
+
+  pthread_mutex_unlock(&connectionsMutex);
+
+  if(conn == NULL)
+  {
+    conn = calloc(1, sizeof(connection_t));
+
+    if(conn == NULL)
+    {
+      logringPrintf(LOG_ERR, "calloc() failed with errno [%d]\n", errno);
+      return NULL;
+    }
+
+    if(framerInit(&conn->framer, kBufferStartLength) != 0)
+    {
+      logringPrintf(LOG_ERR, "malloc() failed with errno [%d]\n", errno);
+      free(conn);
+      return NULL;
+    }
+  }
+
+  conn->cfd = cfd;
+  conn->reactor = reactor;
+  conn->clientAddr = clientAddr;
+  conn->delta = false;
+  conn->cursor = 0;
+  conn->subscribed = false;
+  conn->streaming = false;
+  conn->binary = false;
+  conn->headerOffset = 0;
+  conn->headerLength = 0;
+  conn->queuedNext = 0;
+  conn->queuedCount = 0;
+  conn->corked = false;
+  conn->pipelined = 0;
+  conn->frameStart = 0;
+  conn->file = -1;
+  conn->inflight = 0;
+  conn->recvQueued = false;
+  conn->sendQueued = false;
+  conn->pollQueued = false;
+  conn->closing = false;
+  conn->closePending = false;
+
+  pthread_mutex_lock(&connectionsMutex);
+  LIST_INSERT_HEAD(&connections, conn, entries);
+  pthread_mutex_unlock(&connectionsMutex);
+
+  return conn;
+}
+
+void connectionFree(connection_t *conn)
+{
+  framerRelease(&conn->framer);
+  free(conn);
+}
+
+/**
+ * Reactor mode: takes the store's append reservation for a packet too long
+ * to buffer, see storeReserve(), and starts the reactor's stream timer so a
+ * client that stops sending halfway can't hold up every other append
+ * @return true if the connection now streams the packet
+ */
+static bool streamStart(connection_t *conn)
+{
+  struct itimerspec timer;
+
+  if(workers != NULL || storeReserve() != 0)
+  {
+    return false;
+  }
+
+  conn->streaming = true;
+  conn->streamIdle = false;
+  conn->reactor->streamer = conn;
+
+  timer.it_value.tv_sec = kStreamIdleInterval;
+  timer.it_value.tv_nsec = 0;
+  timer.it_interval = timer.it_value;
+
+  if(timerfd_settime(conn->reactor->streamTimerFd, 0, &timer, NULL) == -1)
+  {
+    logringPrintf(LOG_ERR, "timerfd_settime() failed with errno [%d]\n", errno);
+  }
+
+  return true;
+}
+
+/**
+ * Stops the stream timer once the reservation has been given up
+ */
+static void streamEnd(connection_t *conn)
+{
+  struct itimerspec timer;
+
+  memset(&timer, 0, sizeof(timer));
+  timerfd_settime(conn->reactor->streamTimerFd, 0, &timer, NULL);
+  conn->reactor->streamer = NULL;
+  conn->streaming = false;
+}
+
+/**
+ * Closes the client socket, which also drops it from the epoll set, and
+ * recycles the context. With io_uring operations in flight it only shuts
+ * the socket down so they fail fast; the last completion destroys it.
+ */
+void connectionDestroy(connection_t *conn)
+{
+  char ipaddress[INET_ADDRSTRLEN];
+
+  if(conn->inflight > 0 && conn->reactor->ring != NULL)
+  {
+    if(!conn->closing)
+    {
+      conn->closing = true;
+      shutdown(conn->cfd, SHUT_RDWR);
+    }
+
+    return;
+  }
+
+  if(conn->file != -1 && conn->reactor->ring != NULL)
+  {
+    uringFileRemove(conn->reactor->ring, conn->file);
+  }
+
+  conn->file = -1;
+  conn->inflight = 0;
+  conn->recvQueued = false;
+  conn->sendQueued = false;
+  conn->pollQueued = false;
+  conn->closing = false;
+
+  inet_ntop(AF_INET, &(conn->clientAddr), ipaddress, INET_ADDRSTRLEN);
+  logringPrintf(LOG_DEBUG, "Closed connection from %s", ipaddress);
+  statsAdd(kStatsConnectionsClosed, 1);
+
+  // Before close(), which leaves it in the set while another fd refers to
+  // the same socket. io_uring connections were never added.
+  if(conn->reactor->ring == NULL)
+  {
+    epoll_ctl(conn->reactor->efd, EPOLL_CTL_DEL, conn->cfd, NULL);
+  }
+
+  close(conn->cfd);
+  conn->cfd = -1;
+
+  if(conn->streaming)
+  {
+    storeAbandon();
+    streamEnd(conn);
+  }
+
+  storeUnpin(conn->pin);
+  conn->pin = NULL;
+
+  for(; conn->queuedNext < conn->queuedCount; conn->queuedNext++)
+  {
+    storeUnpin(conn->queued[conn->queuedNext].pin);
+  }
+
+  conn->sending = false;
+  conn->committing = false;
+  conn->pipelined = 0;
+  conn->queuedNext = 0;
+  conn->queuedCount = 0;
+  conn->binary = false;
+  conn->headerLength = 0;
+  logcacheRelease(&conn->view);
+
+  if(conn->reply != NULL)
+  {
+    bufpoolPut(conn->reply, conn->replySize);
+    conn->reply = NULL;
+    conn->replyLength = 0;
+    conn->replyOffset = 0;
+  }
+
+  framerReset(&conn->framer);
+
+  pthread_mutex_lock(&connectionsMutex);
+  LIST_REMOVE(conn, entries);
+
+  if(conn->subscribed)
+  {
+    LIST_REMOVE(conn, subscriberEntries);
+    atomic_fetch_sub(&conn->reactor->subscriberCount, 1);
+    conn->subscribed = false;
+  }
+
+  if(freeConnectionCount < kMaxFreeConnections)
+  {
+    LIST_INSERT_HEAD(&freeConnections, conn, entries);
+    freeConnectionCount++;
+    conn = NULL;
+  }
+
+  pthread_mutex_unlock(&connectionsMutex);
+
+  if(conn != NULL)
+  {
+    connectionFree(conn);
+  }
+}
+
+/**
+ * Reactor thread: closes @param conn once the batch of events being handled
+ * is done, since later events in it may still point at the connection.
+ * They are skipped meanwhile.
+ */
+static void connectionClose(connection_t *conn)
+{
+  if(!conn->closePending)
+  {
+    conn->closePending = true;
+    LIST_INSERT_HEAD(&conn->reactor->closed, conn, closeEntries);
+  }
+}
+
+/**
+ * Destroys the connections closed during the batch of events just handled.
+ * One still waiting for its appends is destroyed by commitPending() once
+ * they are done, as the store still writes to them until then.
+ */
+static void reactorReap(reactor_t *reactor)
+{
+  connection_t *conn = NULL;
+
+  while((conn = LIST_FIRST(&reactor->closed)) != NULL)
+  {
+    LIST_REMOVE(conn, closeEntries);
+
+    if(!conn->committing)
+    {
+      conn->closePending = false;
+      connectionDestroy(conn);
+    }
+  }
+}
+
+/**
+ * Binary mode: fills in @param header for a response of @param length
+ * bytes to the current frame
+ * @return the number of header bytes to send, 0 in text mode
+ */
+static size_t binaryHeader(const connection_t *conn, binprotoHeader_t *header, int status, uint64_t length)
+{
+  header->opcode = conn->frameOpcode;
+  header->status = status;
+  header->reserved = 0;
+  header->tag = htonl(conn->frameTag);
+  header->length = htobe64(length);
+
+  return conn->binary ? sizeof(*header) : 0;
+}
+
+/**
+ * Binary mode: starts a response made of a header alone, reporting
+ * @param status
+ */
+static void binaryRespond(connection_t *conn, int status)
+{
+  conn->headerOffset = 0;
+  conn->headerLength = binaryHeader(conn, &conn->header, status, 0);
+  conn->sending = true;
+  conn->sendOffset = 0;
+  conn->sendEnd = 0;
+  conn->sendStart = statsNow();
+}
+
+/**
+ * Pins logical [@param start, @param end) when the connection sends it from
+ * the store rather than the cache, in place of @param pin
+ * @return the new pin, see storePin()
+ */
+static storePin_t *responsePin(const connection_t *conn, storePin_t *pin, off_t start, off_t end)
+{
+  storePin_t *pinned = (conn->view.buffer == NULL) ? storePin(start, end) : NULL;
+
+  storeUnpin(pin);
+
+  return pinned;
+}
+
+/**
+ * Starts a response covering @param length bytes (or kToEnd) from @param
+ * offset in @param snapshot, or from the connection's cursor for
+ * kFromCursor. When the response cache is enabled the connection sends from
+ * a reference to the shared in-memory copy instead, up to the same end.
+ * Responses that run to the end move the delta cursor there. While
+ * another response is being sent this one is queued behind it.
+ */
+void connectionRespond(connection_t *conn, off_t offset, off_t length, const storeSnapshot_t *snapshot)
+{
+  off_t start = snapshot->base + ((offset == kFromCursor) ? 0 : offset);
+  off_t base = snapshot->base;
+  off_t end = snapshot->length;
+  off_t position = 0;
+  response_t *response = NULL;
+
+  if(offset == kFromCursor && (conn->delta || conn->subscribed))
+  {
+    start = conn->cursor;
+  }
+
+  // Queued responses come from the same view as the one being sent
+  if(conn->sending ? conn->view.buffer != NULL : logcacheAcquire(&conn->view) == 0)
+  {
+    end = conn->view.length;
+    base = conn->view.base;
+  }
+
+  // The view may be more recent, but pipelined responses each stop at
+  // their own snapshot
+  if(snapshot->base + snapshot->length < base + end)
+  {
+    end = (snapshot->base + snapshot->length > base) ? snapshot->base + snapshot->length - base : 0;
+  }
+
+  // Anything the store has dropped since is gone, start at what is left
+  position = (start > base) ? start - base : 0;
+  position = (position < end) ? position : end;
+
+  if(length == kToEnd)
+  {
+    conn->cursor = base + end;
+  }
+  else if(length < end - position)
+  {
+    end = position + length;
+  }
+
+  statsRecord(kStatsResponseSize, end - position);
+
+  if(!conn->sending)
+  {
+    conn->sending = true;
+    conn->sendBase = base;
+    conn->sendOffset = position;
+    conn->sendEnd = end;
+    conn->pin = responsePin(conn, NULL, base + position, base + end);
+    conn->headerOffset = 0;
+    conn->headerLength = binaryHeader(conn, &conn->header, 0, end - position);
+    conn->sendStart = statsNow();
+    return;
+  }
+
+  response = (conn->queuedCount > conn->queuedNext) ? &conn->queued[conn->queuedCount - 1] : NULL;
+
+  // Text responses have no header, so one that picks up where the last one
+  // ends (as pipelined appends do in delta mode) just extends it
+  if(!conn->binary && response != NULL && response->end == base + position)
+  {
+    response->end = base + end;
+    response->pin = responsePin(conn, response->pin, response->start, response->end);
+    return;
+  }
+
+  if(!conn->binary && response == NULL && conn->reply == NULL && conn->sendBase + conn->sendEnd == base + position)
+  {
+    conn->sendEnd = base + end - conn->sendBase;
+    conn->pin = responsePin(conn, conn->pin, conn->sendBase + conn->sendOffset, base + end);
+    return;
+  }
+
+  response = &conn->queued[conn->queuedCount++];
+  response->start = base + position;
+  response->end = base + end;
+  response->pin = responsePin(conn, NULL, response->start, response->end);
+  binaryHeader(conn, &response->header, 0, end - position);
+  response->sendStart = statsNow();
+}
+
+/**
+ * Starts a response made of the statistics report alone
+ * @return false if no buffer could be had for it
+ */
+static bool statsRespond(connection_t *conn)
+{
+  size_t length = 0;
+
+  conn->reply = bufpoolGet(kStatsReplyLength, &conn->replySize);
+
+  if(conn->reply != NULL)
+  {
+    length = statsFormat(conn->reply, conn->replySize);
+  }
+
+  if(conn->reply != NULL && length >= conn->replySize)
+  {
+    bufpoolPut(conn->reply, conn->replySize);
+    conn->reply = bufpoolGet(length + 1, &conn->replySize);
+    length = (conn->reply != NULL) ? statsFormat(conn->reply, conn->replySize) : 0;
+  }
+
+  if(conn->reply == NULL)
+  {
+    logringPrintf(LOG_ERR, "malloc() failed with errno [%d]\n", errno);
+    return false;
+  }
+
+  conn->replyLength = (length < conn->replySize) ? length : conn->replySize - 1;
+  conn->replyOffset = 0;
+  conn->sending = true;
+  conn->sendOffset = 0;
+  conn->sendEnd = 0;
+  conn->headerOffset = 0;
+  conn->headerLength = binaryHeader(conn, &conn->header, 0, conn->replyLength);
+  conn->sendStart = statsNow();
+  statsRecord(kStatsResponseSize, conn->replyLength);
+
+  return true;
+}
+
+static void reactorWake(reactor_t *reactor)
+{
+  const uint64_t one = 1;
+
+  if(write(reactor->notifyFd, &one, sizeof(one)) == -1)
+  {
+    // Only fails when the counter is saturated, a wakeup is pending anyway
+  }
+}
+
+/**
+ * Wakes the reactors that have subscribers to push new data to them, or
+ * requests that were parked behind a streamed packet. Installed as the
+ * store commit hook, so it runs on whichever thread committed.
+ */
+static void commitNotify(void)
+{
+  int i;
+
+  for(i = 0; i < reactorCount; i++)
+  {
+    if(atomic_load(&reactors[i].subscriberCount) > 0 || atomic_load(&reactors[i].commitParked))
+    {
+      reactorWake(&reactors[i]);
+    }
+  }
+}
+
+/**
+ * Turns @param conn into a subscriber starting at the current committed
+ * end. In reactor mode it joins the subscriber list right away; a pool
+ * worker hands it over once it is done servicing it.
+ */
+static void subscriberAdd(connection_t *conn)
+{
+  storeSnapshot_t snapshot;
+
+  // Counted before the snapshot so any later commit wakes the reactor
+  atomic_fetch_add(&conn->reactor->subscriberCount, 1);
+  storeSnapshot(&snapshot);
+
+  conn->cursor = snapshot.base + snapshot.length;
+  conn->subscribed = true;
+
+  if(workers == NULL)
+  {
+    pthread_mutex_lock(&connectionsMutex);
+    LIST_INSERT_HEAD(&conn->reactor->subscribers, conn, subscriberEntries);
+    pthread_mutex_unlock(&connectionsMutex);
+  }
+}
+
+/**
+ * @return true if @param packet starts with @param command and has an
+ *      argument after it
+ */
+static bool isCommand(const char *packet, size_t length, const char *command)
+{
+  return length > strlen(command) && strncmp(packet, command, strlen(command)) == 0;
+}
+
+/**
+ * Accounts for a packet or frame received in full
+ */
+static void frameReceived(connection_t *conn)
+{
+  statsAdd(kStatsPackets, 1);
+  statsRecord(kStatsFrame, statsNow() - conn->frameStart);
+  // Bytes of the next packet may already be buffered
+  conn->frameStart = (conn->framer.length > conn->framer.start) ? statsNow() : 0;
+}
+
+/**
+ * @return true if @param packet is one of the commands processPacket()
+ *      handles rather than data to append
+ */
+static bool isAnyCommand(const char *packet, size_t length)
+{
+  return isCommand(packet, length, kIOCtrlStr) || isCommand(packet, length, kDeltaStr) ||
+         isCommand(packet, length, kReadStr) || isCommand(packet, length, kSubscribeStr) ||
+         isCommand(packet, length, kStatsStr) || isCommand(packet, length, kBinaryStr);
+}
+
+/**
+ * Queues the append of @param length bytes at @param data as the next
+ * request of the connection's pipeline, tagged with the current frame's tag
+ */
+static void pipelineSubmit(connection_t *conn, const char *data, size_t length)
+{
+  pipelined_t *entry = &conn->pipeline[conn->pipelined++];
+
+  entry->request.data = data;
+  entry->request.length = length;
+  entry->tag = conn->frameTag;
+  storeSubmit(&entry->request);
+}
+
+/**
+ * Binary mode: checks that an append's payload can be stored as it is
+ * @return false if it lacks the trailing newline the store needs, see
+ *      storeWholeCommands()
+ */
+static bool binaryAppendable(const char *payload, size_t length)
+{
+  return !storeWholeCommands() || (length > 0 && payload[length - 1] == '\n');
+}
+
+/**
+ * Submits the appends the client has already sent behind the one just
+ * submitted, up to MAX_PIPELINED, so they share its commit. Stops at the
+ * first packet that isn't a complete append, which is handled once their
+ * responses are out.
+ */
+static void pipelineGather(connection_t *conn)
+{
+  binprotoHeader_t header;
+  char *packet = NULL;
+  size_t length = 0;
+
+  while(conn->pipelined < MAX_PIPELINED)
+  {
+    if(conn->binary)
+    {
+      packet = framerPeek(&conn->framer, sizeof(header));
+
+      if(packet == NULL)
+      {
+        return;
+      }
+
+      memcpy(&header, packet, sizeof(header));
+
+      if(header.opcode != BINPROTO_APPEND || be64toh(header.length) > kStreamChunkLength)
+      {
+        return;
+      }
+
+      length = be64toh(header.length);
+      packet = framerPeek(&conn->framer, sizeof(header) + length);
+
+      // One that gets refused is answered on its own
+      if(packet == NULL || !binaryAppendable(packet + sizeof(header), length))
+      {
+        return;
+      }
+
+      framerSkip(&conn->framer, sizeof(header) + length);
+      conn->frameOpcode = header.opcode;
+      conn->frameTag = ntohl(header.tag);
+      packet += sizeof(header);
+    }
+    else
+    {
+      packet = framerNext(&conn->framer, &length);
+
+      if(packet == NULL)
+      {
+        return;
+      }
+
+      if(isAnyCommand(packet, length))
+      {
+        framerUnget(&conn->framer, length);
+        return;
+      }
+    }
+
+    frameReceived(conn);
+    pipelineSubmit(conn, packet, length);
+  }
+}
+
+/**
+ * Starts the responses to the connection's pipeline, in order, once all of
+ * it is committed
+ * @return false with errno set if any of the appends failed
+ */
+static bool pipelineRespond(connection_t *conn)
+{
+  int count = conn->pipelined;
+  int i;
+
+  conn->pipelined = 0;
+
+  for(i = 0; i < count; i++)
+  {
+    if(conn->pipeline[i].request.result != 0)
+    {
+      errno = conn->pipeline[i].request.result;
+      return false;
+    }
+  }
+
+  for(i = 0; i < count; i++)
+  {
+    conn->frameOpcode = BINPROTO_APPEND;
+    conn->frameTag = conn->pipeline[i].tag;
+    connectionRespond(conn, kFromCursor, kToEnd, &conn->pipeline[i].request.snapshot);
+  }
+
+  return true;
+}
+
+/**
+ * Appends the payload of a complete packet or frame, together with the
+ * appends pipelined behind it. In reactor mode they are only queued; the
+ * connection waits for the group commit at the end of the event loop
+ * iteration. A pool worker commits them itself or waits for whoever does.
+ * @return false if the connection should be closed
+ */
+static bool appendPacket(connection_t *conn, const char *data, size_t length)
+{
+  pipelineSubmit(conn, data, length);
+  pipelineGather(conn);
+
+  if(workers == NULL)
+  {
+    conn->committing = true;
+    STAILQ_INSERT_TAIL(&conn->reactor->commitWaiters, conn, commitEntries);
+    return true;
+  }
+
+  // Requests are committed in order, so the last one done means all are
+  storeWait(&conn->pipeline[conn->pipelined - 1].request);
+
+  if(!pipelineRespond(conn))
+  {
+    logringPrintf(LOG_ERR, "write() failed with errno [%d]\n", errno);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Appends a complete packet (or applies a seek or mode command) to the data
+ * store and sets up the connection to stream the resulting response from
+ * it. Commands only affect this connection. Appends go through
+ * appendPacket().
+ * @return false if the connection should be closed
+ */
+bool processPacket(connection_t *conn, char *packet, size_t length)
+{
+  off_t offset = kFromCursor;
+  off_t readLength = kToEnd;
+  storeSnapshot_t snapshot;
+
+  if(conn->subscribed)
+  {
+    return true;
+  }
+
+  if(isCommand(packet, length, kStatsStr))
+  {
+    // AESDCHAR_STATS: replies with the statistics report, see stats.h
+    return statsRespond(conn);
+  }
+
+  if(isCommand(packet, length, kBinaryStr))
+  {
+    // AESDCHAR_BINARY:1 switches to length-prefixed frames, see binproto.h
+    if(atoi(packet + strlen(kBinaryStr)) != 1)
+    {
+      return true;
+    }
+
+    conn->binary = true;
+    conn->frameOpcode = BINPROTO_HELLO;
+    conn->frameTag = 0;
+    binaryRespond(conn, 0);
+    return true;
+  }
+
+  if(isCommand(packet, length, kSubscribeStr))
+  {
+    // AESDCHAR_SUBSCRIBE:1 pushes everything committed from now on
+    if(atoi(packet + strlen(kSubscribeStr)) != 0)
+    {
+      subscriberAdd(conn);
+    }
+
+    return true;
+  }
+
+  if(isCommand(packet, length, kDeltaStr))
+  {
+    // AESDCHAR_DELTA:1 turns delta mode on, AESDCHAR_DELTA:0 off; either way
+    // the reply is what a read in the new mode returns
+    conn->delta = (atoi(packet + strlen(kDeltaStr)) != 0);
+    storeSnapshot(&snapshot);
+  }
+  else if(isCommand(packet, length, kReadStr))
+  {
+    // AESDCHAR_READ:<write cmd>,<offset in cmd>,<length> sends a slice of
+    // the store and leaves it, and the delta cursor, unchanged
+    char *readCmdStr = packet + strlen(kReadStr);
+    uint32_t readCmd = atoi(readCmdStr);
+    uint32_t readCmdOffset = 0;
+
+    readCmdStr = memchr(readCmdStr, ',', length - (readCmdStr - packet));
+    readCmdOffset = (readCmdStr != NULL) ? atoi(readCmdStr + 1) : 0;
+    readCmdStr = (readCmdStr != NULL) ? memchr(readCmdStr + 1, ',', length - (readCmdStr + 1 - packet)) : NULL;
+    readLength = (readCmdStr != NULL) ? strtoll(readCmdStr + 1, NULL, 10) : 0;
+
+    if(readLength < 0 || storeSeekTo(readCmd, readCmdOffset, &offset, &snapshot) != 0)
+    {
+      errno = (readLength < 0) ? EINVAL : errno;
+      logringPrintf(LOG_ERR, "ioctl() failed with errno [%d]\n", errno);
+      return false;
+    }
+  }
+  else if(isCommand(packet, length, kIOCtrlStr))
+  {
+    char *ioctlCmdStr = packet + strlen(kIOCtrlStr);
+    uint32_t writeCmd = atoi(ioctlCmdStr);
+    uint32_t writeCmdOffset = 0;
+
+    ioctlCmdStr = memchr(ioctlCmdStr, ',', length - (ioctlCmdStr - packet));
+    writeCmdOffset = (ioctlCmdStr != NULL) ? atoi(ioctlCmdStr + 1) : 0;
+
+    if(storeSeekTo(writeCmd, writeCmdOffset, &offset, &snapshot) != 0)
+    {
+      logringPrintf(LOG_ERR, "ioctl() failed with errno [%d]\n", errno);
+      return false;
+    }
+  }
+  else
+  {
+    return appendPacket(conn, packet, length);
+  }
+
+  connectionRespond(conn, offset, readLength, &snapshot);
+  return true;
+}
+
+/**
+ * Binary mode: handles a complete frame other than a streamed append,
+ * like processPacket() does a line. Requests the store refuses are
+ * answered with their errno instead of closing the connection.
+ * @return false if the connection should be closed
+ */
+static bool binaryProcess(connection_t *conn, const char *payload, uint64_t length)
+{
+  off_t offset = kFromCursor;
+  off_t readLength = kToEnd;
+  storeSnapshot_t snapshot;
+  uint32_t position[2];
+  uint64_t sliceLength;
+
+  switch(conn->frameOpcode)
+  {
+  case BINPROTO_APPEND:
+    if(!binaryAppendable(payload, length))
+    {
+      binaryRespond(conn, EINVAL);
+      return true;
+    }
+
+    return appendPacket(conn, payload, length);
+  case BINPROTO_SEEKTO:
+  case BINPROTO_READ:
+    if(length != ((conn->frameOpcode == BINPROTO_READ) ? sizeof(position) + sizeof(sliceLength) : sizeof(position)))
+    {
+      binaryRespond(conn, EINVAL);
+      return true;
+    }
+
+    memcpy(position, payload, sizeof(position));
+
+    if(conn->frameOpcode == BINPROTO_READ)
+    {
+      memcpy(&sliceLength, payload + sizeof(position), sizeof(sliceLength));
+      sliceLength = be64toh(sliceLength);
+      readLength = (sliceLength <= INT64_MAX) ? (off_t)sliceLength : INT64_MAX;
+    }
+
+    if(storeSeekTo(ntohl(position[0]), ntohl(position[1]), &offset, &snapshot) != 0)
+    {
+      binaryRespond(conn, errno);
+      return true;
+    }
+    break;
+  case BINPROTO_DELTA:
+    if(length != 1)
+    {
+      binaryRespond(conn, EINVAL);
+      return true;
+    }
+
+    conn->delta = (payload[0] != 0);
+    storeSnapshot(&snapshot);
+    break;
+  case BINPROTO_STATS:
+    return statsRespond(conn);
+  default:
+    binaryRespond(conn, EINVAL);
+    return true;
+  }
+
+  connectionRespond(conn, offset, readLength, &snapshot);
+  return true;
+}
+
+/**
+ * Binary mode: takes the next frame once it is all buffered, reserving
+ * room for it in one go. Appends too long to buffer are streamed to the
+ * store as they arrive, as in text mode.
+ * @return 1 if a frame (or part of one) was handled, 0 if more data is
+ *      needed, -1 if the connection should be closed
+ */
+static int binaryNext(connection_t *conn)
+{
+  binprotoHeader_t header;
+  storeSnapshot_t snapshot;
+  uint64_t length;
+  char *frame = NULL;
+  size_t chunkLength;
+
+  if(conn->streaming)
+  {
+    chunkLength = framerPending(&conn->framer);
+
+    if(chunkLength < conn->frameRemaining && chunkLength < kStreamChunkLength)
+    {
+      return 0;
+    }
+
+    chunkLength = (chunkLength < conn->frameRemaining) ? chunkLength : conn->frameRemaining;
+    frame = framerPeek(&conn->framer, chunkLength);
+    framerSkip(&conn->framer, chunkLength);
+    conn->frameRemaining -= chunkLength;
+
+    if(conn->frameRemaining > 0)
+    {
+      if(storeStream(frame, chunkLength) != 0)
+      {
+        logringPrintf(LOG_ERR, "write() failed with errno [%d]\n", errno);
+        return -1;
+      }
+
+      return 1;
+    }
+
+    streamEnd(conn);
+
+    if(storeRelease(frame, chunkLength, &snapshot) != 0)
+    {
+      logringPrintf(LOG_ERR, "write() failed with errno [%d]\n", errno);
+      return -1;
+    }
+
+    frameReceived(conn);
+    connectionRespond(conn, kFromCursor, kToEnd, &snapshot);
+    return 1;
+  }
+
+  frame = framerPeek(&conn->framer, sizeof(header));
+
+  if(frame == NULL)
+  {
+    return 0;
+  }
+
+  memcpy(&header, frame, sizeof(header));
+  length = be64toh(header.length);
+  conn->frameOpcode = header.opcode;
+  conn->frameTag = ntohl(header.tag);
+
+  if(header.opcode != BINPROTO_APPEND && length > kMaxCommandPayload)
+  {
+    logringPrintf(LOG_ERR, "Frame of opcode %u too long: %llu bytes\n", header.opcode, (unsigned long long)length);
+    return -1;
+  }
+
+  // Streaming would write the payload before its last byte can be checked
+  if(length > kStreamChunkLength && !storeWholeCommands() && streamStart(conn))
+  {
+    framerSkip(&conn->framer, sizeof(header));
+    conn->frameRemaining = length;
+    return 1;
+  }
+
+  frame = (length <= SIZE_MAX - sizeof(header)) ? framerPeek(&conn->framer, sizeof(header) + length) : NULL;
+
+  if(frame == NULL)
+  {
+    // The framer mustn't move its buffer under a recv in flight
+    if(!conn->recvQueued && (length > SIZE_MAX - sizeof(header) || framerReserve(&conn->framer, sizeof(header) + length) != 0))
+    {
+      logringPrintf(LOG_ERR, "realloc() failed with errno [%d]\n", (length > SIZE_MAX - sizeof(header)) ? ENOBUFS : errno);
+      return -1;
+    }
+
+    return 0;
+  }
+
+  framerSkip(&conn->framer, sizeof(header) + length);
+  frameReceived(conn);
+
+  return binaryProcess(conn, frame + sizeof(header), length) ? 1 : -1;
+}
+
+/**
+ * Points the connection's message at everything of the pending responses
+ * that is in memory: the header and reply of the current one and, when
+ * they come from the cached view, its data and all the responses queued
+ * behind it
+ * @return the number of buffers, 0 if nothing in memory is left to send
+ */
+static int responseGather(connection_t *conn)
+{
+  struct iovec *iov = conn->iov;
+  response_t *response = NULL;
+  int i;
+
+  if(conn->headerOffset < conn->headerLength)
+  {
+    iov->iov_base = (char *)&conn->header + conn->headerOffset;
+    iov->iov_len = conn->headerLength - conn->headerOffset;
+    iov++;
+  }
+
+  if(conn->replyOffset < conn->replyLength)
+  {
+    iov->iov_base = conn->reply + conn->replyOffset;
+    iov->iov_len = conn->replyLength - conn->replyOffset;
+    iov++;
+  }
+
+  if(conn->view.buffer != NULL && conn->sendOffset < conn->sendEnd)
+  {
+    iov->iov_base = (char *)conn->view.data + conn->sendOffset;
+    iov->iov_len = conn->sendEnd - conn->sendOffset;
+    iov++;
+  }
+
+  for(i = conn->queuedNext; conn->view.buffer != NULL && i < conn->queuedCount; i++)
+  {
+    response = &conn->queued[i];
+
+    if(conn->binary)
+    {
+      iov->iov_base = &response->header;
+      iov->iov_len = sizeof(response->header);
+      iov++;
+    }
+
+    if(response->end > response->start)
+    {
+      iov->iov_base = (char *)conn->view.data + (response->start - conn->sendBase);
+      iov->iov_len = response->end - response->start;
+      iov++;
+    }
+  }
+
+  memset(&conn->message, 0, sizeof(conn->message));
+  conn->message.msg_iov = conn->iov;
+  conn->message.msg_iovlen = iov - conn->iov;
+
+  return iov - conn->iov;
+}
+
+/**
+ * Keeps a header from going out in a segment of its own when the store
+ * data that follows it is sent separately by sendfile()
+ * @return MSG_MORE if store data follows what responseGather() covers
+ */
+static int responseMore(const connection_t *conn)
+{
+  return (conn->view.buffer == NULL && conn->sendOffset < conn->sendEnd) ? MSG_MORE : 0;
+}
+
+/**
+ * Finishes the current response and moves on to the first one queued
+ * behind it, if any
+ * @return true if there was one
+ */
+static bool responseNext(connection_t *conn)
+{
+  response_t *response = NULL;
+
+  statsRecord(kStatsSend, statsNow() - conn->sendStart);
+  storeUnpin(conn->pin);
+  conn->pin = NULL;
+  conn->headerOffset = 0;
+  conn->headerLength = 0;
+
+  if(conn->reply != NULL)
+  {
+    bufpoolPut(conn->reply, conn->replySize);
+    conn->reply = NULL;
+    conn->replyLength = 0;
+    conn->replyOffset = 0;
+  }
+
+  if(conn->queuedNext == conn->queuedCount)
+  {
+    conn->queuedNext = 0;
+    conn->queuedCount = 0;
+    return false;
+  }
+
+  response = &conn->queued[conn->queuedNext++];
+  conn->header = response->header;
+  conn->headerLength = conn->binary ? sizeof(conn->header) : 0;
+  conn->sendOffset = response->start - conn->sendBase;
+  conn->sendEnd = response->end - conn->sendBase;
+  conn->pin = response->pin;
+  conn->sendStart = response->sendStart;
+
+  return true;
+}
+
+/**
+ * Accounts for @param bytes sent of what responseGather() covered
+ */
+static void responseAdvance(connection_t *conn, size_t bytes)
+{
+  size_t part = 0;
+
+  statsAdd(kStatsBytesSent, bytes);
+
+  while(bytes > 0)
+  {
+    if(conn->headerOffset < conn->headerLength)
+    {
+      part = (bytes < conn->headerLength - conn->headerOffset) ? bytes : conn->headerLength - conn->headerOffset;
+      conn->headerOffset += part;
+    }
+    else if(conn->replyOffset < conn->replyLength)
+    {
+      part = (bytes < conn->replyLength - conn->replyOffset) ? bytes : conn->replyLength - conn->replyOffset;
+      conn->replyOffset += part;
+    }
+    else if(conn->sendOffset < conn->sendEnd)
+    {
+      part = (bytes < (size_t)(conn->sendEnd - conn->sendOffset)) ? bytes : (size_t)(conn->sendEnd - conn->sendOffset);
+      conn->sendOffset += part;
+    }
+    else if(responseNext(conn))
+    {
+      continue;
+    }
+    else
+    {
+      break;
+    }
+
+    bytes -= part;
+  }
+}
+
+/**
+ * io_uring reactors: queues a recv of up to @param length bytes into
+ * @param space, which the framer must leave in place until it completes
+ * @return false if the ring refused it
+ */
+static bool uringRecv(connection_t *conn, char *space, size_t length)
+{
+  if(uringPrep(conn->reactor->ring, IORING_OP_RECV, conn->cfd, conn->file, space, length, 0, (uintptr_t)conn | kUringRecv) != 0)
+  {
+    logringPrintf(LOG_ERR, "io_uring_enter() failed with errno [%d]\n", errno);
+    return false;
+  }
+
+  conn->recvQueued = true;
+  conn->inflight++;
+
+  return true;
+}
+
+/**
+ * io_uring reactors: queues a sendmsg() of what is left of the pending
+ * responses in memory, unless one is already in flight
+ * @return true while a send is in flight, false if there is nothing in
+ *      memory left to send or the ring refused it
+ */
+static bool uringSend(connection_t *conn)
+{
+  if(conn->sendQueued)
+  {
+    return true;
+  }
+
+  if(responseGather(conn) == 0)
+  {
+    return false;
+  }
+
+  if(uringPrep(conn->reactor->ring, IORING_OP_SENDMSG, conn->cfd, conn->file, &conn->message, 1, MSG_NOSIGNAL | responseMore(conn), (uintptr_t)conn | kUringSend) != 0)
+  {
+    return false;
+  }
+
+  conn->sendQueued = true;
+  conn->inflight++;
+
+  return true;
+}
+
+/**
+ * io_uring reactors: waits for room in the socket of a response sent
+ * straight from the store, which still goes out synchronously
+ * @return false if the ring refused it
+ */
+static bool uringPoll(connection_t *conn)
+{
+  if(conn->pollQueued)
+  {
+    return true;
+  }
+
+  if(uringPrep(conn->reactor->ring, IORING_OP_POLL_ADD, conn->cfd, conn->file, NULL, 0, POLLOUT, (uintptr_t)conn | kUringPoll) != 0)
+  {
+    logringPrintf(LOG_ERR, "io_uring_enter() failed with errno [%d]\n", errno);
+    return false;
+  }
+
+  conn->pollQueued = true;
+  conn->inflight++;
+
+  return true;
+}
+
+/**
+ * Streams whatever is left of the pending responses to the socket, from the
+ * shared response cache when the connection holds a view of it, otherwise
+ * straight from the data store without copying it through user space.
+ * Responses queued behind the current one go out in the same sendmsg() from
+ * the cache, or corked from the store. io_uring reactors submit the
+ * in-memory part to the ring instead.
+ * @return false on a failure, errno is EAGAIN if the socket is full or a
+ *      send is in flight
+ */
+bool connectionFlush(connection_t *conn)
+{
+  ssize_t bytesSent = 0;
+  int corked = 1;
+
+  // Otherwise every response from the store would end in a short segment
+  if(conn->queuedCount > conn->queuedNext && conn->view.buffer == NULL && !conn->corked)
+  {
+    conn->corked = (setsockopt(conn->cfd, IPPROTO_TCP, TCP_CORK, &corked, sizeof(corked)) == 0);
+  }
+
+  do
+  {
+    if(conn->reactor->ring != NULL && uringSend(conn))
+    {
+      errno = EAGAIN;
+      return false;
+    }
+
+    while(responseGather(conn) > 0)
+    {
+      bytesSent = sendmsg(conn->cfd, &conn->message, MSG_NOSIGNAL | responseMore(conn));
+
+      if(bytesSent == -1)
+      {
+        if(errno == EINTR)
+        {
+          continue;
+        }
+
+        return false;
+      }
+
+      responseAdvance(conn, bytesSent);
+    }
+
+    while(conn->sendOffset < conn->sendEnd)
+    {
+      bytesSent = storeSendfile(conn->cfd, conn->sendBase + conn->sendOffset, conn->sendEnd - conn->sendOffset);
+
+      if(bytesSent > 0)
+      {
+        conn->sendOffset += bytesSent;
+      }
+
+      if(bytesSent == -1)
+      {
+        if(errno == EINTR)
+        {
+          continue;
+        }
+
+        return false;
+      }
+
+      if(bytesSent == 0)
+      {
+        break;
+      }
+
+      statsAdd(kStatsBytesSent, bytesSent);
+    }
+
+    // The header promised the client more than the store still has
+    if(conn->binary && conn->sendOffset < conn->sendEnd)
+    {
+      errno = ENODATA;
+      return false;
+    }
+  }
+  while(responseNext(conn));
+
+  conn->sending = false;
+  logcacheRelease(&conn->view);
+
+  if(conn->corked)
+  {
+    corked = 0;
+    conn->corked = false;
+    setsockopt(conn->cfd, IPPROTO_TCP, TCP_CORK, &corked, sizeof(corked));
+  }
+
+  return true;
+}
+
+/**
+ * Runs the recv -> append -> respond cycle for a connection until the socket
+ * would block (non-blocking sockets) or the peer goes away.
+ * @return false if the connection should be closed
+ */
+bool connectionService(connection_t *conn)
+{
+  ssize_t bytesRecv = 0;
+  char *packet = NULL;
+  char *space = NULL;
+  size_t packetLength = 0;
+  size_t spaceLength = 0;
+  storeSnapshot_t snapshot;
+  int progress;
+
+  while(1)
+  {
+    if(conn->committing || conn->closing)
+    {
+      return true;
+    }
+
+    if(conn->sending && !connectionFlush(conn))
+    {
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        return conn->reactor->ring == NULL || conn->sendQueued || uringPoll(conn);
+      }
+
+      logringPrintf(LOG_ERR, "send() failed with errno [%d]\n", errno);
+      return false;
+    }
+
+    if(conn->subscribed)
+    {
+      storeSnapshot(&snapshot);
+
+      if(conn->cursor < snapshot.base + snapshot.length)
+      {
+        connectionRespond(conn, kFromCursor, kToEnd, &snapshot);
+        continue;
+      }
+    }
+
+    progress = conn->binary ? binaryNext(conn) : 0;
+
+    if(progress != 0)
+    {
+      if(progress < 0)
+      {
+        return false;
+      }
+
+      continue;
+    }
+
+    packet = conn->binary ? NULL : framerNext(&conn->framer, &packetLength);
+
+    if(packet != NULL)
+    {
+      frameReceived(conn);
+
+      if(conn->streaming)
+      {
+        // The end of a packet whose start is already in the store
+        streamEnd(conn);
+
+        if(storeRelease(packet, packetLength, &snapshot) != 0)
+        {
+          logringPrintf(LOG_ERR, "write() failed with errno [%d]\n", errno);
+          return false;
+        }
+
+        connectionRespond(conn, kFromCursor, kToEnd, &snapshot);
+        continue;
+      }
+
+      if(!processPacket(conn, packet, packetLength))
+      {
+        return false;
+      }
+
+      continue;
+    }
+
+    // The framer mustn't move its buffer under a recv in flight
+    if(conn->recvQueued)
+    {
+      return true;
+    }
+
+    // Rather than growing the buffer for a long packet, write it out as it
+    // arrives. Pool workers would block each other on the reservation, so
+    // they (and the memory store) buffer it under the budget instead.
+    if(!conn->binary && framerPending(&conn->framer) >= kStreamChunkLength &&
+       (conn->subscribed || conn->streaming || streamStart(conn)))
+    {
+      packet = framerTake(&conn->framer, &packetLength);
+
+      // Subscribers ignore what they receive
+      if(conn->subscribed)
+      {
+        continue;
+      }
+
+      if(storeStream(packet, packetLength) != 0)
+      {
+        logringPrintf(LOG_ERR, "write() failed with errno [%d]\n", errno);
+        return false;
+      }
+
+      continue;
+    }
+
+    space = framerSpace(&conn->framer, &spaceLength);
+
+    if(space == NULL)
+    {
+      logringPrintf(LOG_ERR, "realloc() failed with errno [%d]\n", errno);
+      return false;
+    }
+
+    // Serviced again once it completes
+    if(conn->reactor->ring != NULL)
+    {
+      return uringRecv(conn, space, spaceLength);
+    }
+
+    bytesRecv = recv(conn->cfd, space, spaceLength, 0);
+
+    if(bytesRecv == 0)
+    {
+      return false;
+    }
+
+    if(bytesRecv == -1)
+    {
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        return true;
+      }
+
+      if(errno == EINTR)
+      {
+        continue;
+      }
+
+      logringPrintf(LOG_ERR, "recv() failed with errno [%d]\n", errno);
+      return false;
+    }
+
+    framerCommit(&conn->framer, bytesRecv);
+    conn->streamIdle = false;
+    statsAdd(kStatsBytesReceived, bytesRecv);
+
+    if(conn->frameStart == 0)
+    {
+      conn->frameStart = statsNow();
+    }
+  }
+}
+
+/**
+ * Reactor mode: group commits every packet queued during this event loop
+ * iteration, then resumes the connections that were waiting on it. Resuming
+ * may queue their next packets, so repeat until nothing is left. Packets
+ * queued behind a streamed one stay parked until the commit that ends it
+ * wakes the reactor.
+ */
+void commitPending(reactor_t *reactor)
+{
+  struct commithead ready = STAILQ_HEAD_INITIALIZER(ready);
+  struct commithead parked = STAILQ_HEAD_INITIALIZER(parked);
+  connection_t *conn = NULL;
+
+  // Before committing, so a reservation released meanwhile still wakes it
+  if(!STAILQ_EMPTY(&reactor->commitWaiters))
+  {
+    atomic_store(&reactor->commitParked, true);
+  }
+
+  while(!STAILQ_EMPTY(&reactor->commitWaiters))
+  {
+    storeCommit();
+
+    STAILQ_SWAP(&ready, &reactor->commitWaiters, connection);
+
+    while((conn = STAILQ_FIRST(&ready)) != NULL)
+    {
+      STAILQ_REMOVE_HEAD(&ready, commitEntries);
+
+      if(!atomic_load(&conn->pipeline[conn->pipelined - 1].request.done))
+      {
+        STAILQ_INSERT_TAIL(&parked, conn, commitEntries);
+        continue;
+      }
+
+      conn->committing = false;
+
+      // Closed while its appends were still being committed
+      if(conn->closePending)
+      {
+        conn->closePending = false;
+        connectionDestroy(conn);
+        continue;
+      }
+
+      if(!pipelineRespond(conn))
+      {
+        logringPrintf(LOG_ERR, "write() failed with errno [%d]\n", errno);
+        connectionDestroy(conn);
+        continue;
+      }
+
+      if(!connectionService(conn))
+      {
+        connectionDestroy(conn);
+      }
+    }
+  }
+
+  STAILQ_CONCAT(&reactor->commitWaiters, &parked);
+  atomic_store(&reactor->commitParked, !STAILQ_EMPTY(&reactor->commitWaiters));
+}
+
+/**
+ * io_uring reactors: accounts for the completion of an operation of @param
+ * conn tagged @param tag, then carries on servicing the connection
+ */
+void connectionComplete(connection_t *conn, uint64_t tag, int result)
+{
+  conn->inflight--;
+  conn->recvQueued = conn->recvQueued && tag != kUringRecv;
+  conn->sendQueued = conn->sendQueued && tag != kUringSend;
+  conn->pollQueued = conn->pollQueued && tag != kUringPoll;
+
+  if(conn->closing)
+  {
+    connectionDestroy(conn);
+    return;
+  }
+
+  if(tag == kUringRecv && result == 0)
+  {
+    connectionDestroy(conn);
+    return;
+  }
+
+  if(result < 0 && result != -EINTR && result != -EAGAIN && tag != kUringPoll)
+  {
+    logringPrintf(LOG_ERR, "%s() failed with errno [%d]\n", (tag == kUringRecv) ? "recv" : "send", -result);
+    connectionDestroy(conn);
+    return;
+  }
+
+  if(tag == kUringRecv && result > 0)
+  {
+    framerCommit(&conn->framer, result);
+    conn->streamIdle = false;
+    statsAdd(kStatsBytesReceived, result);
+
+    if(conn->frameStart == 0)
+    {
+      conn->frameStart = statsNow();
+    }
+  }
+  else if(tag == kUringSend && result > 0)
+  {
+    responseAdvance(conn, result);
+  }
+
+  if(!connectionService(conn))
+  {
+    connectionDestroy(conn);
+  }
+}
+
+/**
+ * Pool worker: services connections handed over by a reactor and either
+ * re-arms them in the epoll set or closes them on the spot. New subscribers
+ * are handed back to their reactor instead, which notices a dead one itself.
+ */
+void *process(void *threadParam)
+{
+  connection_t *conn = NULL;
+  struct epoll_event event;
+  bool serviced;
+
+  while((conn = workqueuePop(&workQueue)) != NULL)
+  {
+    serviced = connectionService(conn);
+
+    if(conn->subscribed)
+    {
+      pthread_mutex_lock(&connectionsMutex);
+      LIST_INSERT_HEAD(&conn->reactor->pendingSubscribers, conn, subscriberEntries);
+      pthread_mutex_unlock(&connectionsMutex);
+      reactorWake(conn->reactor);
+      continue;
+    }
+
+    if(!serviced)
+    {
+      connectionDestroy(conn);
+      continue;
+    }
+
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET | EPOLLONESHOT;
+    event.data.ptr = conn;
+
+    if(epoll_ctl(conn->reactor->efd, EPOLL_CTL_MOD, conn->cfd, &event) == -1)
+    {
+      logringPrintf(LOG_ERR, "epoll_ctl() failed with errno [%d]\n", errno);
+      connectionDestroy(conn);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Reactor thread: adopts subscribers handed over by the pool, then pushes
+ * newly committed data to every subscriber. One that has fallen more than
+ * kMaxSubscriberLag behind is disconnected rather than buffered for.
+ */
+void subscribersWake(reactor_t *reactor)
+{
+  connection_t *conn = NULL;
+  connection_t *tempConn = NULL;
+  struct epoll_event event;
+  storeSnapshot_t snapshot;
+  uint64_t count;
+
+  while(read(reactor->notifyFd, &count, sizeof(count)) == -1 && errno == EINTR);
+
+  pthread_mutex_lock(&connectionsMutex);
+
+  while((conn = LIST_FIRST(&reactor->pendingSubscribers)) != NULL)
+  {
+    LIST_REMOVE(conn, subscriberEntries);
+    LIST_INSERT_HEAD(&reactor->subscribers, conn, subscriberEntries);
+
+    // No longer one-shot, the reactor services it from now on
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = conn;
+
+    if(epoll_ctl(reactor->efd, EPOLL_CTL_MOD, conn->cfd, &event) == -1)
+    {
+      logringPrintf(LOG_ERR, "epoll_ctl() failed with errno [%d]\n", errno);
+    }
+  }
+
+  pthread_mutex_unlock(&connectionsMutex);
+
+  storeSnapshot(&snapshot);
+
+  LIST_FOREACH_SAFE(conn, &reactor->subscribers, subscriberEntries, tempConn)
+  {
+    if(conn->closePending)
+    {
+      continue;
+    }
+
+    if(conn->sending && snapshot.base + snapshot.length - (conn->cursor - (conn->sendEnd - conn->sendOffset)) > kMaxSubscriberLag)
+    {
+      logringPrintf(LOG_WARNING, "Dropping subscriber more than %lld bytes behind", (long long)kMaxSubscriberLag);
+      connectionClose(conn);
+      continue;
+    }
+
+    if(!connectionService(conn))
+    {
+      connectionClose(conn);
+    }
+  }
+}
+
+/**
+ * Starts @param count pool workers. Called with SIGINT/SIGTERM blocked so the
+ * workers inherit that mask.
+ */
+bool startWorkers(int count)
+{
+  if(workqueueInit(&workQueue, kWorkQueueLength) != 0)
+  {
+    logringPrintf(LOG_ERR, "workqueueInit() failed with errno [%d]\n", errno);
+    return false;
+  }
+
+  workers = calloc(count, sizeof(pthread_t));
+
+  if(workers == NULL)
+  {
+    logringPrintf(LOG_ERR, "calloc() failed with errno [%d]\n", errno);
+    return false;
+  }
+
+  for(workerCount = 0; workerCount < count; workerCount++)
+  {
+    if(pthread_create(&workers[workerCount], NULL, process, NULL) != 0)
+    {
+      logringPrintf(LOG_ERR, "pthread_create() failed\n");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void stopWorkers()
+{
+  int i;
+
+  if(workers == NULL)
+  {
+    return;
+  }
+
+  workqueueStop(&workQueue);
+
+  for(i = 0; i < workerCount; i++)
+  {
+    pthread_join(workers[i], NULL);
+  }
+
+  free(workers);
+  workers = NULL;
+  workerCount = 0;
+  workqueueDestroy(&workQueue);
+}
+
+/**
+ * Stops the reactors running on their own threads; the caller is reactor 0
+ */
+void stopReactors()
+{
+  int i;
+
+  gracefullyExit = true;
+
+  for(i = 1; i < reactorCount; i++)
+  {
+    if(reactors[i].cpu != -1)
+    {
+      reactorWake(&reactors[i]);
+      pthread_join(reactors[i].thread, NULL);
+      reactors[i].cpu = -1;
+    }
+  }
+}
+
+void cleanup()
+{
+  connection_t *conn = NULL;
+  connection_t *tempConn = NULL;
+  int i;
+
+  if(reactors != NULL)
+  {
+    stopReactors();
+  }
+
+  stopWorkers();
+
+  // Closing a ring cancels what its connections have in flight, so they can
+  // be destroyed right away
+  for(i = 0; i < reactorCount; i++)
+  {
+    if(reactors[i].ring != NULL)
+    {
+      uringDestroy(reactors[i].ring);
+      free(reactors[i].ring);
+      reactors[i].ring = NULL;
+    }
+  }
+
+  LIST_FOREACH_SAFE(conn, &connections, entries, tempConn)
+  {
+    connectionDestroy(conn);
+  }
+
+  LIST_FOREACH_SAFE(conn, &freeConnections, entries, tempConn)
+  {
+    LIST_REMOVE(conn, entries);
+    connectionFree(conn);
+  }
+
+  for(i = 0; i < reactorCount; i++)
+  {
+    if(reactors[i].efd != -1)
+    {
+      close(reactors[i].efd);
+    }
+
+    if(reactors[i].notifyFd != -1)
+    {
+      close(reactors[i].notifyFd);
+    }
+
+    if(reactors[i].streamTimerFd != -1)
+    {
+      close(reactors[i].streamTimerFd);
+    }
+
+    if(reactors[i].sfd != -1)
+    {
+      close(reactors[i].sfd);
+    }
+  }
+
+  reactorCount = 0;
+  free(reactors);
+  reactors = NULL;
+
+  if(timerFd != -1)
+  {
+    close(timerFd);
+  }
+
+  logcacheDestroy();
+  // Joins the interval sync thread, which records into the stats until then
+  storeClose();
+  statsDestroy();
+  bufpoolDrain();
+  logringStop();
+  closelog();
+}
+
+/**
+ * Reactor 0: appends a timestamp when timerFd expires. It goes through
+ * the regular group commit like any packet, so it never interrupts a thread
+ * that is in the middle of an append, and doesn't wait while a streamed
+ * packet holds the store.
+ */
+void appendTimestamp()
+{
+  static char dateTime[64];
+  static storeRequest_t request = { .done = true };
+  time_t t = time(NULL);
+  struct tm localTime;
+  uint64_t expirations;
+
+  if(read(timerFd, &expirations, sizeof(expirations)) == -1)
+  {
+    return;
+  }
+
+  // Still queued behind a streamed packet, which commits it once it ends
+  if(!atomic_load(&request.done))
+  {
+    return;
+  }
+
+  localtime_r(&t, &localTime);
+  strftime(dateTime, sizeof(dateTime), "timestamp: %Y%m%d%H%M%S", &localTime);
+  strcat(dateTime, "\n");
+
+  request.data = dateTime;
+  request.length = strlen(dateTime);
+  storeSubmit(&request);
+  storeCommit();
+
+  if(atomic_load(&request.done) && request.result != 0)
+  {
+    errno = request.result;
+    logringPrintf(LOG_ERR, "write() failed with errno [%d]\n", errno);
+  }
+}
+
+/**
+ * Arms timerFd to fire right away and then every kTimestampInterval seconds
+ * and adds it to @param reactor
+ */
+bool timestampStart(reactor_t *reactor)
+{
+  struct itimerspec timer;
+  struct epoll_event event;
+
+  timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  if(timerFd == -1)
+  {
+    logringPrintf(LOG_ERR, "timerfd_create() failed with errno [%d]\n", errno);
+    return false;
+  }
+
+  timer.it_value.tv_sec = 0;
+  timer.it_value.tv_nsec = 1;
+  timer.it_interval.tv_sec = kTimestampInterval;
+  timer.it_interval.tv_nsec = 0;
+
+  if(timerfd_settime(timerFd, 0, &timer, NULL) == -1)
+  {
+    logringPrintf(LOG_ERR, "timerfd_settime() failed with errno [%d]\n", errno);
+    return false;
+  }
+
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = &timerFd;
+
+  if(epoll_ctl(reactor->efd, EPOLL_CTL_ADD, timerFd, &event) == -1)
+  {
+    logringPrintf(LOG_ERR, "epoll_ctl() failed with errno [%d]\n", errno);
+    return false;
+  }
+
+  return true;
+}
+
+static void signalHandler(int signo)
+{
+  gracefullyExit = true;
+}
+
+/**
+ * Accepts every pending connection on the reactor's listen socket and
+ * registers it edge-triggered with its efd; one-shot when a worker pool
+ * services it. An io_uring reactor registers it with its ring instead and
+ * starts servicing it right away.
+ */
+bool acceptConnections(reactor_t *reactor)
+{
+  int cfd;
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  char ipaddress[INET_ADDRSTRLEN];
+  connection_t *conn = NULL;
+  struct epoll_event event;
+  const int one = 1;
+
+  while(1)
+  {
+    cfd = accept4(reactor->sfd, (struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK);
+
+    if(cfd == -1)
+    {
+      if(errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        return true;
+      }
+
+      if(errno == EINTR || errno == ECONNABORTED)
+      {
+        continue;
+      }
+
+      logringPrintf(LOG_ERR, "accept() failed with errno [%d]\n", errno);
+      return (errno == EMFILE || errno == ENFILE);
+    }
+
+    if(inet_ntop(AF_INET, &(addr.sin_addr), ipaddress, INET_ADDRSTRLEN) == NULL)
+    {
+      logringPrintf(LOG_ERR, "inet_ntop() failed with errno [%d]\n", errno);
+      close(cfd);
+      continue;
+    }
+
+    logringPrintf(LOG_DEBUG, "Accepted connection from %s", ipaddress);
+    statsAdd(kStatsConnectionsAccepted, 1);
+
+    // Responses are coalesced explicitly (see connectionFlush()); Nagle
+    // would only hold back the next one until a pipelining client acks
+    if(setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1)
+    {
+      logringPrintf(LOG_ERR, "setsockopt() failed with errno [%d]\n", errno);
+    }
+
+    conn = connectionCreate(reactor, cfd, addr.sin_addr);
+
+    if(conn == NULL)
+    {
+      close(cfd);
+      continue;
+    }
 
-const static int kPort = 9000;
-#ifdef USE_AESD_CHAR_DEVICE
-const static char *kSocketData = "/dev/aesdchar";
-const char kIOCtrlStr[] = "AESDCHAR_IOCSEEKTO:";
-#else
-const static char *kSocketData = "/var/tmp/aesdsocketdata";
-#endif
-const static int kBufferStartLength = 128;
+    if(reactor->ring != NULL)
+    {
+      conn->file = uringFileAdd(reactor->ring, cfd);
 
-static int sfd = 0;
-static int fd = 0;
+      if(!connectionService(conn))
+      {
+        connectionDestroy(conn);
+      }
 
-typedef struct socketThreadData
-{
-  pthread_mutex_t *mutexExit;
-  int cfd;
-  bool complete;
-  bool exit;
-}socketThreadData_t;
+      continue;
+    }
 
-typedef struct slistData
-{
-  pthread_t *thread;
-  socketThreadData_t *threadData;
-  struct in_addr clientAddr;
-  SLIST_ENTRY(slistData) entries;
-}slistData_t;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = conn;
 
-volatile sig_atomic_t gracefullyExit = false;
+    if(workers != NULL)
+    {
+      event.events |= EPOLLONESHOT;
+    }
 
-pthread_mutex_t mutex;
+    if(epoll_ctl(reactor->efd, EPOLL_CTL_ADD, cfd, &event) == -1)
+    {
+      logringPrintf(LOG_ERR, "epoll_ctl() failed with errno [%d]\n", errno);
+      connectionDestroy(conn);
+      continue;
+    }
+  }
+}
 
-void freeBuffers(char *recvBuffer, char *sendBuffer)
+/**
+ * Creates the reactor's listening socket and binds it, sharing the port
+ * with the other reactors when there are several. Runs before daemon().
+ */
+bool reactorBind(reactor_t *reactor, const struct sockaddr_in *addr)
 {
-  if(recvBuffer != NULL)
+  const int reuse = 1;
+
+  reactor->sfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+  if(reactor->sfd == -1)
+  {
+    logringPrintf(LOG_ERR, "socket() failed with errno [%d]\n", errno);
+    return false;
+  }
+
+  if(setsockopt(reactor->sfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int)) == -1)
+  {
+    logringPrintf(LOG_ERR, "setsockopt() reusability failed with errno [%d]\n", errno);
+    return false;
+  }
+
+  if(reactorCount > 1 && setsockopt(reactor->sfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(int)) == -1)
   {
-    free(recvBuffer);
+    logringPrintf(LOG_ERR, "setsockopt() port reuse failed with errno [%d]\n", errno);
+    return false;
   }
 
-  if(sendBuffer != NULL)
+  if((bind(reactor->sfd, (struct sockaddr *)addr, sizeof(struct sockaddr_in))) < 0)
   {
-    free(sendBuffer);
+    logringPrintf(LOG_ERR, "bind() failed with errno [%d]\n", errno);
+    return false;
   }
+
+  return true;
 }
 
-void *process(void *threadParam)
+/**
+ * Starts listening and sets up the reactor's epoll set with its listen
+ * socket and notification eventfd
+ */
+bool reactorListen(reactor_t *reactor)
 {
-  socketThreadData_t *threadData = (socketThreadData_t *)threadParam;
+  struct epoll_event event;
 
-  char *recvBuffer = NULL;
-  char *sendBuffer = NULL;
-  char *tempBuffer = NULL;
-  ssize_t bytesRecv = 0;
-  ssize_t bytesSent = 0;
-  ssize_t bytesRead = 0;
-  int bytesProcessed = 0;
-  int bufferSize = 0;
-  int bufferIndex = 0;
-  bool ioctlCmdRecv = false;
-  char *ioctlCmdStr = NULL;
-  struct aesd_seekto seekto;
-  off_t offset;
+  if((listen(reactor->sfd, SOMAXCONN)) != 0)
+  {
+    logringPrintf(LOG_ERR, "listen() failed with errno [%d]\n", errno);
+    return false;
+  }
 
-  while(1)
+  reactor->efd = epoll_create1(EPOLL_CLOEXEC);
+
+  if(reactor->efd == -1)
   {
-    recvBuffer = calloc(kBufferStartLength, sizeof(char));
+    logringPrintf(LOG_ERR, "epoll_create1() failed with errno [%d]\n", errno);
+    return false;
+  }
 
-    if(recvBuffer == NULL)
-    {
-      syslog(LOG_ERR, "calloc() failed with errno [%d]\n", errno);
-      freeBuffers(recvBuffer, sendBuffer);
-      threadData->complete = true;
-      return threadData;
-    }
+  reactor->notifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 
-    bufferSize = kBufferStartLength;
-    bufferIndex = 0;
+  if(reactor->notifyFd == -1)
+  {
+    logringPrintf(LOG_ERR, "eventfd() failed with errno [%d]\n", errno);
+    return false;
+  }
 
-    while(1)
-    {
-      if(threadData->exit)
-      {
-        freeBuffers(recvBuffer, sendBuffer);
-        threadData->complete = true;
-        pthread_mutex_unlock(threadData->mutexExit);
-        return threadData;
-      }
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = &reactor->notifyFd;
 
-      bytesRecv = recv(threadData->cfd, recvBuffer + bufferIndex, (bufferSize - bufferIndex - 1), 0);
+  if(epoll_ctl(reactor->efd, EPOLL_CTL_ADD, reactor->notifyFd, &event) == -1)
+  {
+    logringPrintf(LOG_ERR, "epoll_ctl() failed with errno [%d]\n", errno);
+    return false;
+  }
 
-      if(bytesRecv == -1)
-      {
-        syslog(LOG_ERR, "recv() failed with errno [%d]\n", errno);
-        freeBuffers(recvBuffer, sendBuffer);
-        threadData->complete = true;
-        return threadData;
-      }
-      else if(bytesRecv == (bufferSize - bufferIndex - 1))
-      {
-        bufferSize += kBufferStartLength;
-        bufferIndex = bufferSize - kBufferStartLength - 1;
-        tempBuffer = (char *)realloc(recvBuffer, bufferSize);
+  reactor->streamTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
 
-        if(tempBuffer == NULL)
-        {
-          syslog(LOG_ERR, "realloc() failed with errno [%d]\n", errno);
-          freeBuffers(recvBuffer, sendBuffer);
-          threadData->complete = true;
-          return threadData;
-        }
+  if(reactor->streamTimerFd == -1)
+  {
+    logringPrintf(LOG_ERR, "timerfd_create() failed with errno [%d]\n", errno);
+    return false;
+  }
 
-        recvBuffer = tempBuffer;
-      }
-      else
-      {
-        bufferIndex += bytesRecv;
-      }
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = &reactor->streamTimerFd;
 
-      *(recvBuffer + (bufferSize - 1)) = 0;
+  if(epoll_ctl(reactor->efd, EPOLL_CTL_ADD, reactor->streamTimerFd, &event) == -1)
+  {
+    logringPrintf(LOG_ERR, "epoll_ctl() failed with errno [%d]\n", errno);
+    return false;
+  }
 
-      if(strchr(recvBuffer, '\n') != NULL)
-      {
-        break;
-      }
-    }
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = NULL;
 
-    pthread_mutex_lock(&mutex);
+  if(epoll_ctl(reactor->efd, EPOLL_CTL_ADD, reactor->sfd, &event) == -1)
+  {
+    logringPrintf(LOG_ERR, "epoll_ctl() failed with errno [%d]\n", errno);
+    return false;
+  }
 
-    fd = open(kSocketData, O_RDWR | O_CREAT | O_APPEND, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
+  return true;
+}
 
-    if(strncmp(recvBuffer, kIOCtrlStr, strlen(kIOCtrlStr)) == 0)
-    {
-      ioctlCmdRecv = true;
-      ioctlCmdStr = recvBuffer += strlen(kIOCtrlStr);
-      seekto.write_cmd = atoi(ioctlCmdStr);
-      ioctlCmdStr = strchr(ioctlCmdStr, ',');
-      ioctlCmdStr++;
-      seekto.write_cmd_offset = atoi(ioctlCmdStr);
+/**
+ * The stream timer expired: closes the connection streaming a packet if
+ * nothing more of it arrived over a whole interval, which drops what was
+ * written of the packet (see storeAbandon()) and lets other appends through
+ */
+static void streamCheck(reactor_t *reactor)
+{
+  connection_t *conn = reactor->streamer;
+  char ipaddress[INET_ADDRSTRLEN];
+  uint64_t expirations;
+
+  while(read(reactor->streamTimerFd, &expirations, sizeof(expirations)) == -1 && errno == EINTR);
+
+  if(conn == NULL || conn->closePending)
+  {
+    return;
+  }
+
+  if(!conn->streamIdle)
+  {
+    conn->streamIdle = true;
+    return;
+  }
+
+  inet_ntop(AF_INET, &(conn->clientAddr), ipaddress, INET_ADDRSTRLEN);
+  logringPrintf(LOG_ERR, "Connection from %s stalled in the middle of a packet\n", ipaddress);
+  connectionClose(conn);
+}
+
+/**
+ * Handles the @param nfds ready entries of the reactor's epoll set
+ */
+void reactorDispatch(reactor_t *reactor, const struct epoll_event *events, int nfds)
+{
+  connection_t *conn = NULL;
+  int i;
 
-      if(ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto) != 0)
+  for(i = 0; i < nfds; i++)
+  {
+    if(events[i].data.ptr == NULL)
+    {
+      if(!acceptConnections(reactor))
       {
-        syslog(LOG_ERR, "ioctl() failed with errno [%d]\n", errno);
-        close(fd);
-        pthread_mutex_unlock(&mutex);
-        freeBuffers(recvBuffer, sendBuffer);
-        threadData->complete = true;
-        return threadData;
+        gracefullyExit = true;
       }
+
+      continue;
     }
-    else
-    {
-      bytesSent = write(fd, recvBuffer, strlen(recvBuffer));
 
-      if(bytesSent == -1)
-      {
-        syslog(LOG_ERR, "write() failed with errno [%d]\n", errno);
-        freeBuffers(recvBuffer, sendBuffer);
-        threadData->complete = true;
-        return threadData;
-      }
+    if(events[i].data.ptr == &reactor->notifyFd)
+    {
+      subscribersWake(reactor);
+      continue;
     }
 
-    if(ioctlCmdRecv)
+    if(events[i].data.ptr == &timerFd)
     {
-      offset = lseek(fd, 0, SEEK_CUR);
+      appendTimestamp();
+      continue;
     }
-    else
+
+    if(events[i].data.ptr == &reactor->streamTimerFd)
     {
-      offset = 0;
+      streamCheck(reactor);
+      continue;
     }
 
-    bytesProcessed = lseek(fd, 0, SEEK_END);
+    conn = (connection_t *)events[i].data.ptr;
 
-    if(bytesProcessed == -1)
+    if(conn->closePending)
     {
-      syslog(LOG_ERR, "lseek() failed with errno [%d]\n", errno);
-      close(fd);
-      pthread_mutex_unlock(&mutex);
-      freeBuffers(recvBuffer, sendBuffer);
-      threadData->complete = true;
-      return threadData;
+      continue;
     }
 
-    lseek(fd, offset, SEEK_SET);
+    if(workers != NULL && !conn->subscribed)
+    {
+      workqueuePush(&workQueue, conn);
+    }
+    else if(!connectionService(conn))
+    {
+      connectionClose(conn);
+    }
+  }
+
+  reactorReap(reactor);
+}
 
-    sendBuffer = calloc(bytesProcessed, sizeof(char));
+/**
+ * The io_uring event loop. The epoll set still gathers the listen socket,
+ * notifyFd and the timer, and is itself polled through the ring; every
+ * connection only has its recv and send submitted there.
+ */
+static void reactorRunUring(reactor_t *reactor, const sigset_t *sigmask)
+{
+  struct epoll_event events[kMaxEvents];
+  struct io_uring_cqe *cqe = NULL;
+  bool polling = false;
+  uint64_t userData;
+  int result;
+  int nfds;
 
-    if(sendBuffer == NULL)
+  while(!gracefullyExit)
+  {
+    if(!polling)
     {
-      syslog(LOG_ERR, "calloc() failed with errno [%d]\n", errno);
-      freeBuffers(recvBuffer, sendBuffer);
-      threadData->complete = true;
-      return threadData;
+      polling = uringPrep(reactor->ring, IORING_OP_POLL_ADD, reactor->efd, -1, NULL, 0, POLLIN, kUringEvents) == 0;
     }
-    
-    while(1)
-    {
-      bytesRead = read(fd, sendBuffer, bytesProcessed);
 
-      if(bytesRead == -1)
+    if(uringWait(reactor->ring, sigmask) != 0)
+    {
+      if(errno == EINTR)
       {
-        syslog(LOG_ERR, "read() failed with errno [%d]\n", errno);
-        freeBuffers(recvBuffer, sendBuffer);
-        threadData->complete = true;
-        return threadData;
+        continue;
       }
 
-      if(bytesRead == 0)
-      {
-        break;
-      }
+      logringPrintf(LOG_ERR, "io_uring_enter() failed with errno [%d]\n", errno);
+      break;
+    }
 
-      bytesSent = send(threadData->cfd, sendBuffer, bytesRead, 0);
+    while((cqe = uringPeek(reactor->ring)) != NULL)
+    {
+      userData = cqe->user_data;
+      result = cqe->res;
+      uringSeen(reactor->ring);
 
-      if(bytesSent == -1)
+      if(userData == kUringEvents)
       {
-        syslog(LOG_ERR, "send() failed with errno [%d]\n", errno);
-        freeBuffers(recvBuffer, sendBuffer);
-        threadData->complete = true;
-        return threadData;
+        polling = false;
+        nfds = epoll_wait(reactor->efd, events, kMaxEvents, 0);
+        reactorDispatch(reactor, events, nfds);
+        continue;
       }
+
+      connectionComplete((connection_t *)(uintptr_t)(userData & ~kUringTagMask), userData & kUringTagMask, result);
     }
 
-    close(fd);
-    pthread_mutex_unlock(&mutex);
+    commitPending(reactor);
   }
 }
 
-void cleanup()
+/**
+ * The event loop. @param sigmask is the mask to wait with, reactor 0 uses
+ * it to let SIGINT/SIGTERM through; the others are woken through notifyFd.
+ * With -u the reactor sets up its ring here, on the thread that will submit
+ * to it, and keeps to epoll if the kernel has no io_uring.
+ */
+void reactorRun(reactor_t *reactor, const sigset_t *sigmask)
 {
-  if(sfd != -1)
+  struct epoll_event events[kMaxEvents];
+  int nfds;
+
+  if(useUring && workers == NULL)
+  {
+    reactor->ring = malloc(sizeof(uring_t));
+
+    if(reactor->ring == NULL || uringInit(reactor->ring, kUringEntries, kUringFiles) != 0)
+    {
+      logringPrintf(LOG_ERR, "io_uring_setup() failed with errno [%d], using epoll\n", errno);
+      free(reactor->ring);
+      reactor->ring = NULL;
+    }
+  }
+
+  if(reactor->ring != NULL)
   {
-    close(sfd);
+    reactorRunUring(reactor, sigmask);
   }
 
-  if(fd != -1)
+  while(!gracefullyExit && reactor->ring == NULL)
   {
-    close(fd);
+    nfds = epoll_pwait(reactor->efd, events, kMaxEvents, -1, sigmask);
+
+    if(nfds == -1)
+    {
+      if(errno == EINTR)
+      {
+        continue;
+      }
+
+      logringPrintf(LOG_ERR, "epoll_wait() failed with errno [%d]\n", errno);
+      break;
+    }
+
+    reactorDispatch(reactor, events, nfds);
+    commitPending(reactor);
   }
-#ifndef USE_AESD_CHAR_DEVICE
-  remove(kSocketData);
-#endif
-  closelog();
+
+  // Make sure reactor 0 notices when another one gives up
+  gracefullyExit = true;
+  reactorWake(&reactors[0]);
 }
 
-#ifndef USE_AESD_CHAR_DEVICE
-void appendTimestamp(int signo)
+void *reactorThread(void *threadParam)
 {
-  time_t t = time(NULL);
-  struct tm *localTime= localtime(&t);
-  char dateTime[64] = {0};
+  reactor_t *reactor = (reactor_t *)threadParam;
+  cpu_set_t cpus;
 
-  strftime(dateTime, sizeof(dateTime), "timestamp: %Y%m%d%H%M%S", localTime);
-  strcat(dateTime, "\n");
+  CPU_ZERO(&cpus);
+  CPU_SET(reactor->cpu, &cpus);
+
+  if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+  {
+    logringPrintf(LOG_ERR, "pthread_setaffinity_np() failed\n");
+  }
+
+  reactorRun(reactor, NULL);
+
+  return NULL;
+}
+
+/**
+ * Starts reactors 1.. on their own threads, one per CPU, then pins the
+ * calling thread, which runs reactor 0, to the first CPU. Called with
+ * SIGINT/SIGTERM blocked so the threads inherit that mask.
+ */
+bool startReactors()
+{
+  long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+  cpu_set_t cpus;
+  int i;
+
+  if(reactorCount == 1)
+  {
+    return true;
+  }
+
+  cpuCount = (cpuCount > 0) ? cpuCount : 1;
+
+  for(i = 1; i < reactorCount; i++)
+  {
+    reactors[i].cpu = i % cpuCount;
 
-  pthread_mutex_lock(&mutex);
+    if(pthread_create(&reactors[i].thread, NULL, reactorThread, &reactors[i]) != 0)
+    {
+      logringPrintf(LOG_ERR, "pthread_create() failed\n");
+      reactors[i].cpu = -1;
+      return false;
+    }
+  }
+
+  CPU_ZERO(&cpus);
+  CPU_SET(0, &cpus);
 
-  if(write(fd, dateTime, strlen(dateTime)) == -1)
+  if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
   {
-    syslog(LOG_ERR, "write() failed with errno [%d]\n", errno);
+    logringPrintf(LOG_ERR, "pthread_setaffinity_np() failed\n");
   }
-  pthread_mutex_unlock(&mutex);
+
+  return true;
 }
-#endif
 
-static void signalHandler(int signo)
+void usage(const char *name)
 {
-  syslog(LOG_DEBUG, "Caught signal, exiting");
-  gracefullyExit = true;
+  fprintf(stderr, "Usage: %s [-d] [-t] [-w workers] [-a acceptors] [-g usec] [-c] [-s none|always|group|msec] [-r bytes|packetsp] [-u] [-b char|file|memory] [-m bytes]\n", name);
+  fprintf(stderr, "  -d  run as a daemon\n");
+  fprintf(stderr, "  -t  service connections from a worker pool instead of the reactor threads\n");
+  fprintf(stderr, "  -w  number of pool workers, implies -t (default %d)\n", kDefaultWorkers);
+  fprintf(stderr, "  -a  number of event loops sharing port %d through SO_REUSEPORT, one per CPU (default 1)\n", kPort);
+  fprintf(stderr, "  -g  how long a group commit waits for more packets before writing (default 0)\n");
+  fprintf(stderr, "  -c  send replies from a shared in-memory copy of the store (always on unless -b file)\n");
+  fprintf(stderr, "  -r  keep only about the last bytes (or packets, with a p suffix): files drop whole segments, memory whole packets (default all, 64 MiB in memory)\n");
+  fprintf(stderr, "  -u  submit socket I/O through io_uring where the kernel has it, implies -c (reactor mode only)\n");
+  fprintf(stderr, "  -b  keep the data in /dev/aesdchar, in /var/tmp/aesdsocketdata or in a ring in memory (default char if built with USE_AESD_CHAR_DEVICE, else file)\n");
+  fprintf(stderr, "  -s  fdatasync() the data file after every packet, after every group commit or every msec milliseconds (default none)\n");
+  fprintf(stderr, "  -m  cap on the receive and reply buffers of all connections together, and on a streamed packet kept for the response cache, 0 for none (default %zu)\n", kDefaultBufferBudget);
 }
 
 int main(int argc, char *argv[])
 {
-  int cfd;
-  struct sockaddr_in addr;
   struct sockaddr_in my_addr;
-  char ipaddress[INET_ADDRSTRLEN];
+  sigset_t exitMask;
+  sigset_t origMask;
+  bool runAsDaemon = false;
+  int poolSize = 0;
+  int acceptorCount = 1;
+  storeDurability_t durability = kDurabilityNone;
+  long syncInterval = 0;
+  unsigned long long retentionLimit = 0;
+  unsigned long long bufferBudget = kDefaultBufferBudget;
+  char *end = NULL;
+  storeSnapshot_t snapshot;
+  storeRetention_t retention = kRetainAll;
+  bool useCache = false;
+  int opt;
+  int i;
+
+  while((opt = getopt(argc, argv, "dtw:a:g:cs:r:ub:m:")) != -1)
+  {
+    switch(opt)
+    {
+    case 'd':
+      runAsDaemon = true;
+      break;
+    case 't':
+      poolSize = kDefaultWorkers;
+      break;
+    case 'w':
+      poolSize = atoi(optarg);
+
+      if(poolSize <= 0)
+      {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'a':
+      acceptorCount = atoi(optarg);
+
+      if(acceptorCount <= 0 || acceptorCount > kMaxReactors)
+      {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'g':
+      storeSetCommitWindow(atol(optarg));
+      break;
+    case 'c':
+      useCache = true;
+      break;
+    case 'u':
+      // The ring sends responses from memory, which the cache provides
+      useUring = true;
+      useCache = true;
+      break;
+    case 's':
+      if(strcmp(optarg, "none") == 0)
+      {
+        durability = kDurabilityNone;
+      }
+      else if(strcmp(optarg, "always") == 0)
+      {
+        durability = kDurabilityAlways;
+      }
+      else if(strcmp(optarg, "group") == 0)
+      {
+        durability = kDurabilityGroup;
+      }
+      else
+      {
+        durability = kDurabilityInterval;
+        syncInterval = atol(optarg);
+      }
+
+      if(durability == kDurabilityInterval && syncInterval <= 0)
+      {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'r':
+      retentionLimit = strtoull(optarg, &end, 10);
+      retention = (*end == 'p') ? kRetainPackets : kRetainBytes;
+
+      if(end == optarg || (*end != '\0' && strcmp(end, "p") != 0))
+      {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'b':
+      if(strcmp(optarg, "char") == 0)
+      {
+        storeSetBackend(kStoreChar);
+      }
+      else if(strcmp(optarg, "file") == 0)
+      {
+        storeSetBackend(kStoreFile);
+      }
+      else if(strcmp(optarg, "memory") == 0)
+      {
+        storeSetBackend(kStoreMemory);
+      }
+      else
+      {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case 'm':
+      bufferBudget = strtoull(optarg, &end, 10);
+
+      if(end == optarg || *end != '\0')
+      {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    default:
+      usage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  bufpoolSetBudget(bufferBudget);
+
+  // Once the backend is known
+  if(storeSetRetention(retention, retentionLimit) != 0)
+  {
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // Every reply would otherwise read the driver back under its lock, and
+  // the memory ring keeps its data in the cache
+  if(storeBackend() != kStoreFile)
+  {
+    useCache = true;
+  }
 
   memset(&my_addr, 0, sizeof(my_addr));
 
@@ -306,174 +2768,145 @@ int main(int argc, char *argv[])
   my_addr.sin_addr.s_addr = htonl(INADDR_ANY);
   my_addr.sin_port = htons(kPort);
 
-  slistData_t *node = NULL;
-  slistData_t *tempNode = NULL;
-  socketThreadData_t *threadData = NULL;
-
-#ifndef USE_AESD_CHAR_DEVICE
-  pthread_mutex_init(&mutex, NULL);
-#endif
-
   openlog(argv[0], LOG_PID, LOG_USER);
 
-  SLIST_HEAD(slisthead, slistData) head;
-  SLIST_INIT(&head);
-
-  sfd = socket(AF_INET, SOCK_STREAM, 0);
+  reactors = calloc(acceptorCount, sizeof(reactor_t));
 
-  if(sfd == -1)
+  if(reactors == NULL)
   {
-    syslog(LOG_ERR, "socket() failed with errno [%d]\n", errno);
+    logringPrintf(LOG_ERR, "calloc() failed with errno [%d]\n", errno);
     cleanup();
     exit(EXIT_FAILURE);
   }
 
-  const int opt = 1;
-  if(setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(int)) == -1)
+  reactorCount = acceptorCount;
+
+  for(i = 0; i < reactorCount; i++)
   {
-    syslog(LOG_ERR, "setsockopt() reusability failed with errno [%d]\n", errno);
-    cleanup();
-    exit(EXIT_FAILURE);
+    reactors[i].sfd = -1;
+    reactors[i].efd = -1;
+    reactors[i].notifyFd = -1;
+    reactors[i].streamTimerFd = -1;
+    reactors[i].cpu = -1;
+    STAILQ_INIT(&reactors[i].commitWaiters);
+    LIST_INIT(&reactors[i].subscribers);
+    LIST_INIT(&reactors[i].pendingSubscribers);
+    LIST_INIT(&reactors[i].closed);
+    atomic_init(&reactors[i].subscriberCount, 0);
+  }
+
+  for(i = 0; i < reactorCount; i++)
+  {
+    if(!reactorBind(&reactors[i], &my_addr))
+    {
+      cleanup();
+      exit(EXIT_FAILURE);
+    }
   }
 
-  fcntl(sfd, F_SETFL, O_NONBLOCK);
+  if(runAsDaemon)
+  {
+    if(daemon(0,0) < 0)
+    {
+      logringPrintf(LOG_ERR, "daemon() failed with errno [%d]\n", errno);
+    }
+  }
 
-  if((bind(sfd, (struct sockaddr *)&my_addr, sizeof(struct sockaddr_in))) < 0)
+  if(storeOpen() != 0)
   {
-    syslog(LOG_ERR, "bind() failed with errno [%d]\n", errno);
+    logringPrintf(LOG_ERR, "open() failed with errno [%d]\n", errno);
     cleanup();
     exit(EXIT_FAILURE);
   }
 
-  if(argc == 2 && (!strcmp(argv[1], "-d")))
+  if(useCache)
   {
-    if(daemon(0,0) < 0)
+    storeSnapshot(&snapshot);
+
+    if(logcacheInit(snapshot.length, snapshot.generation) != 0)
     {
-      syslog(LOG_ERR, "daemon() failed with errno [%d]\n", errno);
+      logringPrintf(LOG_ERR, "logcacheInit() failed with errno [%d]\n", errno);
     }
   }
 
   if(signal(SIGINT, signalHandler) == SIG_ERR)
   {
-    syslog(LOG_ERR, "SIGINT");
+    logringPrintf(LOG_ERR, "SIGINT");
     cleanup();
     exit(EXIT_FAILURE);
   }
 
   if(signal(SIGTERM, signalHandler) == SIG_ERR)
   {
-    syslog(LOG_ERR, "SIGTERM");
+    logringPrintf(LOG_ERR, "SIGTERM");
     cleanup();
     exit(EXIT_FAILURE);
   }
 
-#ifndef USE_AESD_CHAR_DEVICE
-  if(signal(SIGALRM, appendTimestamp) == SIG_ERR)
+  // sendfile() has no MSG_NOSIGNAL, so a client that goes away while the
+  // file store streams to it would otherwise kill the daemon; it gets EPIPE
+  if(signal(SIGPIPE, SIG_IGN) == SIG_ERR)
   {
-    syslog(LOG_ERR, "SIGALRM");
+    logringPrintf(LOG_ERR, "SIGPIPE");
     cleanup();
     exit(EXIT_FAILURE);
   }
 
-  struct itimerval timer;
-  timer.it_value.tv_sec = 0;
-  timer.it_value.tv_usec = 1;
-  timer.it_interval.tv_sec = 10;
-  timer.it_interval.tv_usec = 0;
-  if(setitimer(ITIMER_REAL, &timer, NULL) == -1)
+  // SIGINT/SIGTERM are only let through while sleeping in epoll_pwait() so
+  // the main loop reliably sees gracefullyExit; pool workers and the log
+  // thread inherit the blocked mask.
+  sigemptyset(&exitMask);
+  sigaddset(&exitMask, SIGINT);
+  sigaddset(&exitMask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &exitMask, &origMask);
+
+  // After daemon(), which keeps no threads
+  if(logringStart() != 0)
   {
-    syslog(LOG_ERR, "setitimer() failed with errno [%d]\n", errno);
-    cleanup();
-    exit(EXIT_FAILURE);
+    logringPrintf(LOG_ERR, "pthread_create() failed with errno [%d]\n", errno);
   }
-#endif
 
-  if((listen(sfd, 10)) != 0)
+  if(storeSetDurability(durability, syncInterval) != 0)
   {
-    syslog(LOG_ERR, "listen() failed with errno [%d]\n", errno);
+    logringPrintf(LOG_ERR, "storeSetDurability() failed with errno [%d]\n", errno);
     cleanup();
     exit(EXIT_FAILURE);
   }
 
-  socklen_t addrlen = sizeof(addr);
-
-  while(!gracefullyExit)
+  for(i = 0; i < reactorCount; i++)
   {
-    cfd = accept(sfd, (struct sockaddr *)&addr, &addrlen);
-
-    if(cfd == -1)
-    {
-      if(errno == EAGAIN || errno == EWOULDBLOCK)
-      {
-        continue;
-      }
-
-      syslog(LOG_ERR, "accept() failed with errno [%d]\n", errno);
-      cleanup();
-      exit(EXIT_FAILURE);
-    }
-
-    if(inet_ntop(AF_INET, &(addr.sin_addr), ipaddress, INET_ADDRSTRLEN) == NULL)
+    if(!reactorListen(&reactors[i]))
     {
-      syslog(LOG_ERR, "inet_ntop() failed with errno [%d]\n", errno);
       cleanup();
       exit(EXIT_FAILURE);
     }
+  }
 
-    syslog(LOG_DEBUG, "Accepted connection from %s", ipaddress);
-
-    threadData = (socketThreadData_t *)malloc(sizeof(socketThreadData_t));
-    threadData->cfd = cfd;
-    threadData->mutexExit = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
-    pthread_mutex_init(threadData->mutexExit, NULL);
-    threadData->complete = false;
-    threadData->exit = false;
-
-    node = (slistData_t *)malloc(sizeof(slistData_t));
-    node->thread = (pthread_t *)malloc(sizeof(pthread_t));
-    node->threadData = threadData;
-    node->clientAddr = addr.sin_addr;
-    SLIST_INSERT_HEAD(&head, node, entries);
-
-    pthread_create(node->thread, NULL, process, (void *)threadData);
+  storeSetCommitHook(commitNotify);
 
-    SLIST_FOREACH_SAFE(node, &head, entries, tempNode)
-    {
-      if(node->threadData->complete)
-      {
-        pthread_join(*(node->thread), NULL);
-        inet_ntop(AF_INET, &(node->clientAddr), ipaddress, INET_ADDRSTRLEN);
-        syslog(LOG_DEBUG, "Closed connection from %s", ipaddress);
-        close(node->threadData->cfd);
-        SLIST_REMOVE(&head, node, slistData, entries);
-        free(node->threadData->mutexExit);
-        free(node->threadData);
-        free(node->thread);
-        free(node);
-      }
-    }
+  // The driver is only ever written to by the clients
+  if(storeBackend() != kStoreChar && !timestampStart(&reactors[0]))
+  {
+    cleanup();
+    exit(EXIT_FAILURE);
   }
 
-  SLIST_FOREACH(node, &head, entries)
+  if(poolSize > 0 && !startWorkers(poolSize))
   {
-    pthread_mutex_lock(node->threadData->mutexExit);
-    node->threadData->exit = true;
-    pthread_mutex_unlock(node->threadData->mutexExit);
+    cleanup();
+    exit(EXIT_FAILURE);
   }
 
-  SLIST_FOREACH_SAFE(node, &head, entries, tempNode)
+  if(!startReactors())
   {
-    pthread_join(*(node->thread), NULL);
-    inet_ntop(AF_INET, &(node->clientAddr), ipaddress, INET_ADDRSTRLEN);
-    syslog(LOG_DEBUG, "Closed connection from %s", ipaddress);
-    close(node->threadData->cfd);
-    SLIST_REMOVE(&head, node, slistData, entries);
-    free(node->threadData->mutexExit);
-    free(node->threadData);
-    free(node->thread);
-    free(node);
+    cleanup();
+    exit(EXIT_FAILURE);
   }
 
+  reactorRun(&reactors[0], &origMask);
+
+  logringPrintf(LOG_DEBUG, "Caught signal, exiting");
+
   cleanup();
   exit(EXIT_SUCCESS);
 }
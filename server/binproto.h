@@ -0,0 +1,78 @@
+/*
+ * binproto.h
+ *
+ * Wire format of the aesdsocket binary mode. A connection switches to it by
+ * sending the line BINPROTO_HANDSHAKE, which is answered with a
+ * BINPROTO_HELLO frame. From then on every request and every response is a
+ * binprotoHeader_t followed by length bytes of payload, so neither side
+ * scans for newlines and payloads may contain any byte. Requests are
+ * handled, and answered, in order, so a client may send many before reading
+ * any response.
+ */
+
+#ifndef AESD_BINPROTO_H
+#define AESD_BINPROTO_H
+
+#include <stdint.h>
+
+#define BINPROTO_HANDSHAKE "AESDCHAR_BINARY:1\n"
+
+/**
+ * Multi-byte fields are in network byte order
+ */
+typedef struct binprotoHeader
+{
+  /**
+   * One of binprotoOpcode_t; a response carries the opcode of its request
+   */
+  uint8_t opcode;
+  /**
+   * Responses only: 0, or the errno of a request that failed
+   */
+  uint8_t status;
+  uint16_t reserved;
+  /**
+   * Chosen by the client and echoed in the response
+   */
+  uint32_t tag;
+  uint64_t length;
+}binprotoHeader_t;
+
+typedef enum binprotoOpcode
+{
+  /**
+   * Answers the handshake, without payload
+   */
+  BINPROTO_HELLO = 0,
+  /**
+   * The payload is appended as it is. As in text mode, every newline ends a
+   * write command (the unit of SEEKTO and READ), so a payload holding
+   * several lines adds several, and one without a trailing newline runs
+   * into the next append. On the aesdchar driver, which keeps such a
+   * payload to itself, it must end with a newline or fails with EINVAL and
+   * nothing stored. The response is what a text mode write gets back: the
+   * store, or only what is new since the last response in delta mode.
+   */
+  BINPROTO_APPEND = 1,
+  /**
+   * Payload: uint32_t write command, uint32_t offset within it. The
+   * response is the store from there on, as for AESDCHAR_IOCSEEKTO.
+   */
+  BINPROTO_SEEKTO = 2,
+  /**
+   * Payload: uint32_t write command, uint32_t offset within it, uint64_t
+   * length. The response is that slice, as for AESDCHAR_READ.
+   */
+  BINPROTO_READ = 3,
+  /**
+   * No payload, the response is the AESDCHAR_STATS report
+   */
+  BINPROTO_STATS = 4,
+  /**
+   * Payload: uint8_t, 1 to turn delta mode on and 0 to turn it off. The
+   * response is what a read in the new mode returns, as for AESDCHAR_DELTA.
+   */
+  BINPROTO_DELTA = 5
+}binprotoOpcode_t;
+
+#endif /* AESD_BINPROTO_H */
@@ -0,0 +1,199 @@
+/**
+ * @file bufpool.c
+ * @brief Power of two size classes with bounded per class free lists
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "bufpool.h"
+
+// 128 B .. 1 MiB
+#define BUFPOOL_CLASSES 14
+
+// Upper bound on the bytes each class keeps cached
+#define BUFPOOL_CLASS_CACHE_BYTES (2 * 1024 * 1024)
+
+typedef struct freeBuffer
+{
+  struct freeBuffer *next;
+}freeBuffer_t;
+
+typedef struct sizeClass
+{
+  pthread_mutex_t mutex;
+  freeBuffer_t *head;
+  size_t count;
+}sizeClass_t;
+
+#define SIZE_CLASS_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, NULL, 0 }
+
+static sizeClass_t classes[BUFPOOL_CLASSES] = {
+  SIZE_CLASS_INITIALIZER, SIZE_CLASS_INITIALIZER, SIZE_CLASS_INITIALIZER, SIZE_CLASS_INITIALIZER,
+  SIZE_CLASS_INITIALIZER, SIZE_CLASS_INITIALIZER, SIZE_CLASS_INITIALIZER, SIZE_CLASS_INITIALIZER,
+  SIZE_CLASS_INITIALIZER, SIZE_CLASS_INITIALIZER, SIZE_CLASS_INITIALIZER, SIZE_CLASS_INITIALIZER,
+  SIZE_CLASS_INITIALIZER, SIZE_CLASS_INITIALIZER
+};
+
+// Bytes handed out and not returned yet, and the cap on them (0 for none)
+static atomic_size_t outstanding = 0;
+static size_t budget = 0;
+
+/**
+ * @return the class index for @param size, or -1 if it is too large to pool
+ */
+static int sizeClassIndex(size_t size)
+{
+  int index = 0;
+  size_t classSize = BUFPOOL_MIN_SIZE;
+
+  while(classSize < size)
+  {
+    classSize <<= 1;
+    index++;
+  }
+
+  return (index < BUFPOOL_CLASSES) ? index : -1;
+}
+
+void bufpoolSetBudget(size_t bytes)
+{
+  budget = bytes;
+}
+
+/**
+ * Counts @param size more bytes as handed out
+ * @return false if that would exceed the budget
+ */
+static bool budgetCharge(size_t size)
+{
+  size_t previous = atomic_fetch_add(&outstanding, size);
+
+  if(budget > 0 && previous + size > budget)
+  {
+    atomic_fetch_sub(&outstanding, size);
+    errno = ENOBUFS;
+    return false;
+  }
+
+  return true;
+}
+
+int bufpoolCharge(size_t bytes)
+{
+  return budgetCharge(bytes) ? 0 : -1;
+}
+
+void bufpoolUncharge(size_t bytes)
+{
+  atomic_fetch_sub(&outstanding, bytes);
+}
+
+void *bufpoolGet(size_t size, size_t *actualSize)
+{
+  int index = sizeClassIndex(size);
+  sizeClass_t *sizeClass = NULL;
+  freeBuffer_t *buffer = NULL;
+
+  *actualSize = (index == -1) ? size : (size_t)BUFPOOL_MIN_SIZE << index;
+
+  if(!budgetCharge(*actualSize))
+  {
+    return NULL;
+  }
+
+  if(index == -1)
+  {
+    buffer = malloc(size);
+
+    if(buffer == NULL)
+    {
+      atomic_fetch_sub(&outstanding, size);
+    }
+
+    return buffer;
+  }
+
+  sizeClass = &classes[index];
+
+  pthread_mutex_lock(&sizeClass->mutex);
+  buffer = sizeClass->head;
+
+  if(buffer != NULL)
+  {
+    sizeClass->head = buffer->next;
+    sizeClass->count--;
+  }
+
+  pthread_mutex_unlock(&sizeClass->mutex);
+
+  if(buffer == NULL)
+  {
+    buffer = malloc(*actualSize);
+  }
+
+  if(buffer == NULL)
+  {
+    atomic_fetch_sub(&outstanding, *actualSize);
+  }
+
+  return buffer;
+}
+
+void bufpoolPut(void *buffer, size_t size)
+{
+  int index = sizeClassIndex(size);
+  sizeClass_t *sizeClass = NULL;
+  freeBuffer_t *node = buffer;
+
+  if(buffer == NULL)
+  {
+    return;
+  }
+
+  atomic_fetch_sub(&outstanding, size);
+
+  if(index == -1 || ((size_t)BUFPOOL_MIN_SIZE << index) != size)
+  {
+    free(buffer);
+    return;
+  }
+
+  sizeClass = &classes[index];
+
+  pthread_mutex_lock(&sizeClass->mutex);
+
+  if((sizeClass->count + 1) * size <= BUFPOOL_CLASS_CACHE_BYTES)
+  {
+    node->next = sizeClass->head;
+    sizeClass->head = node;
+    sizeClass->count++;
+    node = NULL;
+  }
+
+  pthread_mutex_unlock(&sizeClass->mutex);
+
+  free(node);
+}
+
+void bufpoolDrain(void)
+{
+  freeBuffer_t *buffer = NULL;
+  int i;
+
+  for(i = 0; i < BUFPOOL_CLASSES; i++)
+  {
+    pthread_mutex_lock(&classes[i].mutex);
+
+    while((buffer = classes[i].head) != NULL)
+    {
+      classes[i].head = buffer->next;
+      free(buffer);
+    }
+
+    classes[i].count = 0;
+    pthread_mutex_unlock(&classes[i].mutex);
+  }
+}
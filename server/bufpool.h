@@ -0,0 +1,58 @@
+/*
+ * bufpool.h
+ *
+ * Size-classed pool of receive buffers shared by the aesdsocket reactor and
+ * workers. Sizes are rounded up to a power of two between
+ * BUFPOOL_MIN_SIZE and BUFPOOL_MAX_SIZE; released buffers are kept on a per
+ * class free list so steady-state traffic doesn't reach the allocator.
+ * Buffers handed out are counted against a global budget, so whatever
+ * clients send, the connections' buffers can't outgrow it.
+ */
+
+#ifndef AESD_BUFPOOL_H
+#define AESD_BUFPOOL_H
+
+#include <stddef.h>
+
+#define BUFPOOL_MIN_SIZE 128
+#define BUFPOOL_MAX_SIZE (1024 * 1024)
+
+/**
+ * @param size minimum number of bytes needed
+ * @param actualSize set to the usable size of the returned buffer, which must
+ *      be passed back to bufpoolPut()
+ * @return the buffer, or NULL if it could not be allocated; errno is
+ *      ENOBUFS if it would have exceeded the budget
+ */
+void *bufpoolGet(size_t size, size_t *actualSize);
+
+/**
+ * Returns @param buffer of @param size bytes (as reported by bufpoolGet()) to
+ * its size class, or frees it if that class is already holding enough.
+ */
+void bufpoolPut(void *buffer, size_t size);
+
+/**
+ * Counts @param bytes held outside the pool, such as the part of a packet
+ * the response cache keeps while it is streamed, against the budget
+ * @return 0 on success, -1 with errno ENOBUFS if it would have exceeded it
+ */
+int bufpoolCharge(size_t bytes);
+
+/**
+ * Gives back @param bytes counted by bufpoolCharge()
+ */
+void bufpoolUncharge(size_t bytes);
+
+/**
+ * Caps the bytes handed out and not yet returned at @param bytes, 0 (the
+ * default) for no cap. Buffers cached on the free lists don't count.
+ */
+void bufpoolSetBudget(size_t bytes);
+
+/**
+ * Frees every cached buffer, called at shutdown
+ */
+void bufpoolDrain(void);
+
+#endif /* AESD_BUFPOOL_H */
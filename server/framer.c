@@ -0,0 +1,191 @@
+/**
+ * @file framer.c
+ * @brief Incremental newline framing of aesdsocket receive buffers
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "framer.h"
+#include "bufpool.h"
+
+int framerInit(framer_t *framer, size_t initialSize)
+{
+  memset(framer, 0, sizeof(framer_t));
+
+  framer->buffer = bufpoolGet(initialSize, &framer->size);
+
+  if(framer->buffer == NULL)
+  {
+    return -1;
+  }
+
+  framer->initialSize = framer->size;
+
+  return 0;
+}
+
+void framerReset(framer_t *framer)
+{
+  char *tempBuffer = NULL;
+  size_t tempSize = 0;
+
+  framer->start = 0;
+  framer->scan = 0;
+  framer->length = 0;
+
+  if(framer->size > framer->initialSize)
+  {
+    tempBuffer = bufpoolGet(framer->initialSize, &tempSize);
+
+    if(tempBuffer != NULL)
+    {
+      bufpoolPut(framer->buffer, framer->size);
+      framer->buffer = tempBuffer;
+      framer->size = tempSize;
+    }
+  }
+}
+
+void framerRelease(framer_t *framer)
+{
+  bufpoolPut(framer->buffer, framer->size);
+  framer->buffer = NULL;
+  framer->size = 0;
+}
+
+char *framerNext(framer_t *framer, size_t *length)
+{
+  char *packet = framer->buffer + framer->start;
+  char *newline = memchr(framer->buffer + framer->scan, '\n', framer->length - framer->scan);
+
+  if(newline == NULL)
+  {
+    framer->scan = framer->length;
+    return NULL;
+  }
+
+  *length = newline + 1 - packet;
+  framer->start += *length;
+  framer->scan = framer->start;
+
+  return packet;
+}
+
+void framerUnget(framer_t *framer, size_t length)
+{
+  framer->start -= length;
+  // Only the packet's own newline, its last byte, needs finding again
+  framer->scan = framer->start + length - 1;
+}
+
+size_t framerPending(const framer_t *framer)
+{
+  return framer->length - framer->start;
+}
+
+char *framerTake(framer_t *framer, size_t *length)
+{
+  char *partial = framer->buffer + framer->start;
+
+  *length = framer->length - framer->start;
+  framer->start = framer->length;
+  framer->scan = framer->length;
+
+  return partial;
+}
+
+char *framerPeek(const framer_t *framer, size_t length)
+{
+  return (framer->length - framer->start >= length) ? framer->buffer + framer->start : NULL;
+}
+
+void framerSkip(framer_t *framer, size_t length)
+{
+  framer->start += length;
+
+  if(framer->scan < framer->start)
+  {
+    framer->scan = framer->start;
+  }
+}
+
+int framerReserve(framer_t *framer, size_t length)
+{
+  char *tempBuffer = NULL;
+  size_t tempSize = 0;
+
+  if(framer->size - framer->start >= length)
+  {
+    return 0;
+  }
+
+  if(framer->size < length)
+  {
+    tempBuffer = bufpoolGet(length, &tempSize);
+
+    if(tempBuffer == NULL)
+    {
+      return -1;
+    }
+
+    memcpy(tempBuffer, framer->buffer + framer->start, framer->length - framer->start);
+    bufpoolPut(framer->buffer, framer->size);
+    framer->buffer = tempBuffer;
+    framer->size = tempSize;
+  }
+  else
+  {
+    memmove(framer->buffer, framer->buffer + framer->start, framer->length - framer->start);
+  }
+
+  framer->length -= framer->start;
+  framer->scan -= framer->start;
+  framer->start = 0;
+
+  return 0;
+}
+
+char *framerSpace(framer_t *framer, size_t *space)
+{
+  char *tempBuffer = NULL;
+  size_t tempSize = 0;
+
+  if(framer->start == framer->length)
+  {
+    framer->start = 0;
+    framer->scan = 0;
+    framer->length = 0;
+  }
+  else if(framer->length == framer->size && framer->start > 0)
+  {
+    memmove(framer->buffer, framer->buffer + framer->start, framer->length - framer->start);
+    framer->length -= framer->start;
+    framer->scan -= framer->start;
+    framer->start = 0;
+  }
+
+  // Grow geometrically so a packet of n bytes costs O(log n) copies
+  if(framer->length == framer->size)
+  {
+    tempBuffer = bufpoolGet(framer->size * 2, &tempSize);
+
+    if(tempBuffer == NULL)
+    {
+      return NULL;
+    }
+
+    memcpy(tempBuffer, framer->buffer, framer->length);
+    bufpoolPut(framer->buffer, framer->size);
+    framer->buffer = tempBuffer;
+    framer->size = tempSize;
+  }
+
+  *space = framer->size - framer->length;
+
+  return framer->buffer + framer->length;
+}
+
+void framerCommit(framer_t *framer, size_t bytes)
+{
+  framer->length += bytes;
+}
@@ -0,0 +1,120 @@
+/*
+ * framer.h
+ *
+ * Streaming newline framer for aesdsocket receive buffers. It remembers how
+ * far it has already scanned so every received byte is searched once, and
+ * hands out every complete packet in place without copying it.
+ */
+
+#ifndef AESD_FRAMER_H
+#define AESD_FRAMER_H
+
+#include <stddef.h>
+
+typedef struct framer
+{
+  /**
+   * Receive buffer, taken from the buffer pool by framerInit()
+   */
+  char *buffer;
+  /**
+   * Allocated size of buffer
+   */
+  size_t size;
+  /**
+   * Start of the first packet not yet handed out by framerNext()
+   */
+  size_t start;
+  /**
+   * Bytes in [start, scan) are known not to contain a newline
+   */
+  size_t scan;
+  /**
+   * Number of bytes received into buffer
+   */
+  size_t length;
+  /**
+   * Size the buffer is created with and shrunk back to by framerReset()
+   */
+  size_t initialSize;
+}framer_t;
+
+/**
+ * @return 0 on success, -1 if the buffer could not be allocated
+ */
+int framerInit(framer_t *framer, size_t initialSize);
+
+/**
+ * Drops any buffered data and swaps a grown buffer back to the pool for one
+ * of the initial size so the framer can be reused for another connection.
+ */
+void framerReset(framer_t *framer);
+
+void framerRelease(framer_t *framer);
+
+/**
+ * Finds the next complete packet, scanning only bytes not looked at before.
+ * @param length set to the packet length including its newline
+ * @return pointer to the packet inside the receive buffer, valid until the
+ *      next framerSpace() call, or NULL if no complete packet is buffered
+ */
+char *framerNext(framer_t *framer, size_t *length);
+
+/**
+ * Puts back the packet of @param length bytes just returned by framerNext(),
+ * so the next call hands it out again
+ */
+void framerUnget(framer_t *framer, size_t length);
+
+/**
+ * @return the number of bytes buffered of a packet whose newline hasn't
+ *      arrived, once framerNext() has returned NULL
+ */
+size_t framerPending(const framer_t *framer);
+
+/**
+ * Hands out the partial packet counted by framerPending() so it can be
+ * written out before it is complete; the framer forgets it and frames the
+ * rest of the packet as if it started there.
+ * @param length set to its length
+ * @return pointer into the receive buffer, valid until the next
+ *      framerSpace() call
+ */
+char *framerTake(framer_t *framer, size_t *length);
+
+/**
+ * Frames that say how long they are instead of ending in a newline use
+ * these rather than framerNext().
+ * @return the first @param length buffered bytes, valid until the next
+ *      framerSpace() call, or NULL if fewer are buffered
+ */
+char *framerPeek(const framer_t *framer, size_t length);
+
+/**
+ * Drops the first @param length buffered bytes, which must all be there
+ */
+void framerSkip(framer_t *framer, size_t length);
+
+/**
+ * Makes sure a frame of @param length bytes fits in the buffer, allocating
+ * once for all of it rather than doubling as it arrives. Moves the buffered
+ * data, so no recv may be in flight.
+ * @return 0 on success, -1 if the buffer could not be grown
+ */
+int framerReserve(framer_t *framer, size_t length);
+
+/**
+ * Makes room for the next recv(). A partial packet is only moved to the
+ * front when the buffer is full, and the buffer only doubles (through the
+ * buffer pool) when the partial packet fills all of it.
+ * @param space set to the number of bytes available at the returned pointer
+ * @return where to receive into, or NULL if the buffer could not be grown
+ */
+char *framerSpace(framer_t *framer, size_t *space);
+
+/**
+ * Accounts for @param bytes received at the pointer returned by framerSpace()
+ */
+void framerCommit(framer_t *framer, size_t bytes);
+
+#endif /* AESD_FRAMER_H */
@@ -0,0 +1,331 @@
+/**
+ * @file logcache.c
+ * @brief Generation tagged, reference counted response cache
+ *
+ * The current buffer only ever grows at its end while readers look at bytes
+ * they captured before, so extending it needs no copy and no reader lock.
+ * When it runs out of room (or, in char device mode, when the driver has
+ * dropped old entries and the dead prefix gets large) the live bytes are
+ * moved to a new buffer; the old one is freed by its last reader.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "logcache.h"
+#include "store.h"
+#include "bufpool.h"
+
+const static size_t kMinCapacity = 4096;
+
+struct logcacheBuffer
+{
+  atomic_int refs;
+  /**
+   * Offset in data of store offset 0; grows as the store drops old data
+   */
+  size_t start;
+  /**
+   * End of the cached bytes in data
+   */
+  size_t end;
+  size_t capacity;
+  char data[];
+};
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static logcacheBuffer_t *current = NULL;
+static uint64_t currentGeneration = 0;
+static off_t currentBase = 0;
+// Bytes of a packet being streamed, kept past the end of current until the
+// append that ends the packet publishes them. A client decides how long the
+// packet gets, so they count against the connections' buffer budget.
+static size_t staged = 0;
+
+static logcacheBuffer_t *bufferCreate(size_t capacity)
+{
+  logcacheBuffer_t *buffer = NULL;
+
+  if(capacity < kMinCapacity)
+  {
+    capacity = kMinCapacity;
+  }
+
+  buffer = malloc(sizeof(logcacheBuffer_t) + capacity);
+
+  if(buffer == NULL)
+  {
+    return NULL;
+  }
+
+  atomic_init(&buffer->refs, 1);
+  buffer->start = 0;
+  buffer->end = 0;
+  buffer->capacity = capacity;
+
+  return buffer;
+}
+
+static void bufferRelease(logcacheBuffer_t *buffer)
+{
+  if(buffer != NULL && atomic_fetch_sub_explicit(&buffer->refs, 1, memory_order_acq_rel) == 1)
+  {
+    free(buffer);
+  }
+}
+
+/**
+ * Forgets what is staged and gives its bytes back to the budget. Called
+ * with mutex held.
+ */
+static void unstage(void)
+{
+  bufpoolUncharge(staged);
+  staged = 0;
+}
+
+/**
+ * Disables the cache; senders fall back to the store. Called with mutex
+ * held.
+ */
+static void cacheDisable(void)
+{
+  bufferRelease(current);
+  current = NULL;
+  unstage();
+}
+
+int logcacheInit(off_t length, uint64_t generation)
+{
+  logcacheBuffer_t *buffer = bufferCreate(length * 2);
+  ssize_t bytes = 0;
+
+  if(buffer == NULL)
+  {
+    return -1;
+  }
+
+  while(buffer->end < (size_t)length)
+  {
+    bytes = storePread(buffer->data + buffer->end, length - buffer->end, buffer->end);
+
+    if(bytes == -1 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if(bytes <= 0)
+    {
+      break;
+    }
+
+    buffer->end += bytes;
+  }
+
+  if(bytes == -1)
+  {
+    free(buffer);
+    return -1;
+  }
+
+  pthread_mutex_lock(&mutex);
+  bufferRelease(current);
+  current = buffer;
+  currentGeneration = generation;
+  currentBase = 0;
+  unstage();
+  pthread_mutex_unlock(&mutex);
+
+  return 0;
+}
+
+void logcacheDestroy(void)
+{
+  pthread_mutex_lock(&mutex);
+  cacheDisable();
+  pthread_mutex_unlock(&mutex);
+}
+
+bool logcacheEnabled(void)
+{
+  bool enabled;
+
+  pthread_mutex_lock(&mutex);
+  enabled = (current != NULL);
+  pthread_mutex_unlock(&mutex);
+
+  return enabled;
+}
+
+/**
+ * Moves what current holds past its first @param evicted live bytes to a
+ * new buffer with room for @param length more. Called with mutex held.
+ * @return 0 on success, -1 with errno set and current unchanged on failure
+ */
+static int bufferMove(size_t evicted, size_t length)
+{
+  size_t live = current->end - current->start - evicted;
+  logcacheBuffer_t *buffer = bufferCreate((live + staged + length) * 2);
+
+  if(buffer == NULL)
+  {
+    return -1;
+  }
+
+  memcpy(buffer->data, current->data + current->start + evicted, live + staged);
+  buffer->end = live;
+  bufferRelease(current);
+  current = buffer;
+
+  return 0;
+}
+
+/**
+ * Drops @param evicted bytes from the front of current and makes room for
+ * @param length more behind what is staged. Called with mutex held.
+ * @return false if the cache had to be disabled
+ */
+static bool bufferMakeRoom(size_t evicted, size_t length)
+{
+  size_t live = current->end - current->start;
+  bool fits = (current->end + staged + length <= current->capacity);
+
+  currentBase += evicted;
+  evicted = (evicted > live) ? live : evicted;
+
+  // Readers may still be sending the evicted bytes, so only move start
+  if((!fits || current->start + evicted > current->capacity / 2) && bufferMove(evicted, length) == 0)
+  {
+    return true;
+  }
+
+  if(!fits)
+  {
+    // Better no cache than a stale one; senders fall back to the store
+    cacheDisable();
+    return false;
+  }
+
+  // Compacting can wait for the next append
+  current->start += evicted;
+
+  return true;
+}
+
+int logcacheReserve(size_t length)
+{
+  int result = 0;
+
+  pthread_mutex_lock(&mutex);
+
+  if(current == NULL)
+  {
+    errno = ENOMEM;
+    result = -1;
+  }
+  else if(current->end + staged + length > current->capacity)
+  {
+    result = bufferMove(0, length);
+  }
+
+  pthread_mutex_unlock(&mutex);
+
+  return result;
+}
+
+void logcacheStage(const char *data, size_t length)
+{
+  pthread_mutex_lock(&mutex);
+
+  if(current == NULL)
+  {
+    pthread_mutex_unlock(&mutex);
+    return;
+  }
+
+  // A packet too long for the budget isn't kept in memory at all, the
+  // cache can't leave it out without going stale
+  if(bufpoolCharge(length) != 0)
+  {
+    cacheDisable();
+  }
+  else if(bufferMakeRoom(0, length))
+  {
+    memcpy(current->data + current->end + staged, data, length);
+    staged += length;
+  }
+  else
+  {
+    bufpoolUncharge(length);
+  }
+
+  pthread_mutex_unlock(&mutex);
+}
+
+void logcacheUnstage(void)
+{
+  pthread_mutex_lock(&mutex);
+  unstage();
+  pthread_mutex_unlock(&mutex);
+}
+
+void logcacheAppend(const struct iovec *iov, int count, size_t written, size_t evicted, uint64_t generation)
+{
+  size_t length = 0;
+  int i;
+
+  pthread_mutex_lock(&mutex);
+
+  if(current == NULL || !bufferMakeRoom(evicted, written))
+  {
+    pthread_mutex_unlock(&mutex);
+    return;
+  }
+
+  // What was staged goes first, it is the start of the first packet
+  current->end += staged;
+  unstage();
+
+  for(i = 0; i < count && written > 0; i++)
+  {
+    length = (iov[i].iov_len < written) ? iov[i].iov_len : written;
+    memcpy(current->data + current->end, iov[i].iov_base, length);
+    current->end += length;
+    written -= length;
+  }
+
+  currentGeneration = generation;
+  pthread_mutex_unlock(&mutex);
+}
+
+int logcacheAcquire(logcacheView_t *view)
+{
+  pthread_mutex_lock(&mutex);
+
+  if(current == NULL)
+  {
+    pthread_mutex_unlock(&mutex);
+    view->buffer = NULL;
+    return -1;
+  }
+
+  atomic_fetch_add_explicit(&current->refs, 1, memory_order_relaxed);
+  view->buffer = current;
+  view->data = current->data + current->start;
+  view->length = current->end - current->start;
+  view->base = currentBase;
+  view->generation = currentGeneration;
+
+  pthread_mutex_unlock(&mutex);
+
+  return 0;
+}
+
+void logcacheRelease(logcacheView_t *view)
+{
+  bufferRelease(view->buffer);
+  view->buffer = NULL;
+}
@@ -0,0 +1,92 @@
+/*
+ * logcache.h
+ *
+ * Shared, reference counted in-memory copy of the aesdsocket data store.
+ * It is extended by each group commit with the bytes just written, so every
+ * response can be sent from one shared buffer instead of each client
+ * reading the store back on its own.
+ */
+
+#ifndef AESD_LOGCACHE_H
+#define AESD_LOGCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+typedef struct logcacheBuffer logcacheBuffer_t;
+
+/**
+ * A read-only view of the store as of one append generation. The bytes in
+ * data[0, length) stay valid and unchanged until logcacheRelease().
+ */
+typedef struct logcacheView
+{
+  logcacheBuffer_t *buffer;
+  /**
+   * Store offset 0
+   */
+  const char *data;
+  off_t length;
+  /**
+   * Logical position of data[0], see storeSnapshot_t
+   */
+  off_t base;
+  uint64_t generation;
+}logcacheView_t;
+
+/**
+ * Enables the cache, loading the first @param length bytes of the store,
+ * which has just been opened
+ * @return 0 on success, -1 with errno set on failure
+ */
+int logcacheInit(off_t length, uint64_t generation);
+
+void logcacheDestroy(void);
+
+bool logcacheEnabled(void);
+
+/**
+ * Adds anything staged and then the first @param written bytes of @param
+ * iov to the cache, after dropping @param evicted bytes from the front when
+ * the store has discarded its oldest data. Called by the store's commit
+ * leader before it publishes @param generation. Running out of memory for
+ * the bytes disables the cache, unless logcacheReserve() made room for them.
+ */
+void logcacheAppend(const struct iovec *iov, int count, size_t written, size_t evicted, uint64_t generation);
+
+/**
+ * Makes sure @param length more bytes can be appended without allocating,
+ * for a store that has nowhere else to keep them
+ * @return 0 on success, -1 with errno set if the cache is disabled or
+ *      couldn't grow, in which case it is left as it was
+ */
+int logcacheReserve(size_t length);
+
+/**
+ * Keeps @param length bytes of a packet the store is streaming, see
+ * storeStream(), out of sight until the logcacheAppend() that ends the
+ * packet adds them ahead of its own bytes. They are charged to the buffer
+ * budget, see bufpoolCharge(), until then; a packet that doesn't fit in it
+ * disables the cache instead.
+ */
+void logcacheStage(const char *data, size_t length);
+
+/**
+ * Forgets what was staged for a packet the store has dropped
+ */
+void logcacheUnstage(void);
+
+/**
+ * Takes a reference on the current contents
+ * @return 0 on success, -1 if the cache is disabled
+ */
+int logcacheAcquire(logcacheView_t *view);
+
+/**
+ * Drops the reference taken by logcacheAcquire(); a no-op for an empty view
+ */
+void logcacheRelease(logcacheView_t *view);
+
+#endif /* AESD_LOGCACHE_H */
@@ -0,0 +1,240 @@
+/**
+ * @file logring.c
+ * @brief Bounded multi-producer ring of log records drained by one thread
+ *
+ * Each slot carries a sequence number (the classic bounded MPMC queue): a
+ * producer owns slot pos once it wins the CAS on enqueuePos while the slot's
+ * sequence equals pos, and publishes it by storing pos + 1. The drain thread
+ * hands slot pos back to producers by storing pos + LOGRING_SLOTS. Once the
+ * ring is empty the drain thread blocks on an eventfd, which only the first
+ * producer to find it asleep writes to.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "logring.h"
+
+// Must be a power of two
+#define LOGRING_SLOTS 1024
+
+#define LOGRING_MESSAGE_LENGTH 192
+
+typedef struct logSlot
+{
+  atomic_size_t sequence;
+  int priority;
+  char message[LOGRING_MESSAGE_LENGTH];
+}logSlot_t;
+
+static logSlot_t slots[LOGRING_SLOTS];
+static atomic_size_t enqueuePos = 0;
+// Only touched by the drain thread
+static size_t dequeuePos = 0;
+static atomic_ulong dropped = 0;
+static atomic_bool running = false;
+static pthread_t drainThread;
+// Set by the drain thread before it blocks on wakeFd
+static atomic_bool sleeping = false;
+static int wakeFd = -1;
+
+/**
+ * Passes every published record to syslog(), then reports drops
+ * @return true if anything was written
+ */
+static bool drain(void)
+{
+  logSlot_t *slot = NULL;
+  unsigned long lost;
+  bool drained = false;
+
+  while(1)
+  {
+    slot = &slots[dequeuePos & (LOGRING_SLOTS - 1)];
+
+    if(atomic_load_explicit(&slot->sequence, memory_order_acquire) != dequeuePos + 1)
+    {
+      break;
+    }
+
+    syslog(slot->priority, "%s", slot->message);
+    atomic_store_explicit(&slot->sequence, dequeuePos + LOGRING_SLOTS, memory_order_release);
+    dequeuePos++;
+    drained = true;
+  }
+
+  lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+
+  if(lost > 0)
+  {
+    syslog(LOG_WARNING, "Dropped %lu log messages\n", lost);
+  }
+
+  return drained;
+}
+
+/**
+ * Wakes the drain thread if it is blocked, or about to block, on wakeFd
+ */
+static void wake(void)
+{
+  const uint64_t one = 1;
+
+  // Pairs with the fence in drainLoop(): either the drain thread sees the
+  // record just published, or this sees it asleep
+  atomic_thread_fence(memory_order_seq_cst);
+
+  if(atomic_load_explicit(&sleeping, memory_order_relaxed) && atomic_exchange(&sleeping, false))
+  {
+    if(write(wakeFd, &one, sizeof(one)) == -1)
+    {
+      // Only fails when the counter is saturated, a wakeup is pending anyway
+    }
+  }
+}
+
+static void *drainLoop(void *threadParam)
+{
+  uint64_t count;
+
+  while(atomic_load_explicit(&running, memory_order_acquire))
+  {
+    if(drain())
+    {
+      continue;
+    }
+
+    atomic_store(&sleeping, true);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // Whatever was published before the flag was set is drained first; a
+    // producer that cleared the flag meanwhile leaves a spurious wakeup
+    if(drain() || !atomic_load_explicit(&running, memory_order_acquire))
+    {
+      atomic_store(&sleeping, false);
+      continue;
+    }
+
+    if(read(wakeFd, &count, sizeof(count)) == -1 && errno != EINTR)
+    {
+      break;
+    }
+  }
+
+  drain();
+
+  return NULL;
+}
+
+int logringStart(void)
+{
+  size_t i;
+  int result;
+
+  for(i = 0; i < LOGRING_SLOTS; i++)
+  {
+    atomic_init(&slots[i].sequence, i);
+  }
+
+  atomic_store(&enqueuePos, 0);
+  dequeuePos = 0;
+  atomic_store(&sleeping, false);
+  wakeFd = eventfd(0, EFD_CLOEXEC);
+
+  if(wakeFd == -1)
+  {
+    return -1;
+  }
+
+  atomic_store(&running, true);
+
+  result = pthread_create(&drainThread, NULL, drainLoop, NULL);
+
+  if(result != 0)
+  {
+    atomic_store(&running, false);
+    close(wakeFd);
+    wakeFd = -1;
+    errno = result;
+    return -1;
+  }
+
+  return 0;
+}
+
+void logringStop(void)
+{
+  const uint64_t one = 1;
+
+  if(atomic_exchange(&running, false))
+  {
+    if(write(wakeFd, &one, sizeof(one)) == -1)
+    {
+      // Only fails when the counter is saturated, a wakeup is pending anyway
+    }
+
+    pthread_join(drainThread, NULL);
+    close(wakeFd);
+    wakeFd = -1;
+  }
+}
+
+void logringPrintf(int priority, const char *format, ...)
+{
+  logSlot_t *slot = NULL;
+  size_t pos;
+  intptr_t diff;
+  va_list args;
+
+  va_start(args, format);
+
+  if(!atomic_load_explicit(&running, memory_order_acquire))
+  {
+    vsyslog(priority, format, args);
+    va_end(args);
+    return;
+  }
+
+  pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+
+  while(1)
+  {
+    slot = &slots[pos & (LOGRING_SLOTS - 1)];
+    diff = (intptr_t)atomic_load_explicit(&slot->sequence, memory_order_acquire) - (intptr_t)pos;
+
+    if(diff == 0)
+    {
+      if(atomic_compare_exchange_weak_explicit(&enqueuePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if(diff < 0)
+    {
+      // Full: the drain thread hasn't caught up with this lap yet
+      atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+      wake();
+      va_end(args);
+      return;
+    }
+    else
+    {
+      pos = atomic_load_explicit(&enqueuePos, memory_order_relaxed);
+    }
+  }
+
+  slot->priority = priority;
+  vsnprintf(slot->message, sizeof(slot->message), format, args);
+  atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+  wake();
+
+  va_end(args);
+}
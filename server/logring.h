@@ -0,0 +1,31 @@
+/*
+ * logring.h
+ *
+ * Asynchronous syslog front end for aesdsocket. Messages are formatted into
+ * a fixed size lock-free ring by any thread and handed to syslog() in
+ * batches by a background thread, so logging never blocks the reactor or
+ * the workers. When the ring is full new messages are dropped and counted.
+ */
+
+#ifndef AESD_LOGRING_H
+#define AESD_LOGRING_H
+
+/**
+ * Starts the drain thread. Until then, and after logringStop(), messages go
+ * straight to syslog(). Call it after daemon(), which keeps no threads.
+ * @return 0 on success, -1 with errno set on failure
+ */
+int logringStart(void);
+
+/**
+ * Writes out everything still queued and stops the drain thread
+ */
+void logringStop(void);
+
+/**
+ * Queues a message with syslog() semantics. Never blocks; the message is
+ * dropped if the ring is full and truncated if it is unusually long.
+ */
+void logringPrintf(int priority, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif /* AESD_LOGRING_H */
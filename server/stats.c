@@ -0,0 +1,260 @@
+/**
+ * @file stats.c
+ * @brief Per thread counters and log-linear histograms
+ *
+ * Histogram buckets split every power of two into 8 linear sub-buckets, so
+ * 496 buckets cover the whole uint64_t range. Each shard belongs to one
+ * thread, which is the only writer; relaxed atomics keep the readers that
+ * sum shards from seeing torn values without costing the writer anything.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "stats.h"
+
+#define STATS_SUB_BUCKET_BITS 3
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BUCKET_BITS)
+#define STATS_BUCKETS ((64 - STATS_SUB_BUCKET_BITS + 1) * STATS_SUB_BUCKETS)
+
+const static char *kCounterNames[kStatsCounters] = {
+  "connections_accepted",
+  "connections_closed",
+  "packets",
+  "bytes_received",
+  "bytes_sent",
+  "commits"
+};
+
+const static char *kHistogramNames[kStatsHistograms] = {
+  "frame_ns",
+  "lock_wait_ns",
+  "append_ns",
+  "sync_ns",
+  "send_ns",
+  "response_bytes"
+};
+
+typedef struct statsShard
+{
+  atomic_uint_fast64_t counters[kStatsCounters];
+  atomic_uint_fast64_t buckets[kStatsHistograms][STATS_BUCKETS];
+  atomic_uint_fast64_t max[kStatsHistograms];
+  struct statsShard *next;
+}statsShard_t;
+
+static pthread_mutex_t shardsMutex = PTHREAD_MUTEX_INITIALIZER;
+static statsShard_t *shards = NULL;
+static _Thread_local statsShard_t *localShard = NULL;
+
+/**
+ * @return the calling thread's shard, registering it on first use, or NULL
+ *      if it could not be allocated
+ */
+static statsShard_t *shard(void)
+{
+  if(localShard == NULL)
+  {
+    localShard = calloc(1, sizeof(statsShard_t));
+
+    if(localShard != NULL)
+    {
+      pthread_mutex_lock(&shardsMutex);
+      localShard->next = shards;
+      shards = localShard;
+      pthread_mutex_unlock(&shardsMutex);
+    }
+  }
+
+  return localShard;
+}
+
+static int bucketIndex(uint64_t value)
+{
+  int msb;
+
+  if(value < STATS_SUB_BUCKETS)
+  {
+    return value;
+  }
+
+  msb = 63 - __builtin_clzll(value);
+
+  return (msb - STATS_SUB_BUCKET_BITS + 1) * STATS_SUB_BUCKETS + ((value >> (msb - STATS_SUB_BUCKET_BITS)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/**
+ * @return the largest value that lands in bucket @param index
+ */
+static uint64_t bucketValue(int index)
+{
+  int shift;
+
+  if(index < STATS_SUB_BUCKETS)
+  {
+    return index;
+  }
+
+  shift = index / STATS_SUB_BUCKETS - 1;
+
+  return (((uint64_t)(STATS_SUB_BUCKETS + index % STATS_SUB_BUCKETS + 1)) << shift) - 1;
+}
+
+uint64_t statsNow(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void statsAdd(statsCounter_t counter, uint64_t value)
+{
+  statsShard_t *local = shard();
+
+  if(local != NULL)
+  {
+    atomic_store_explicit(&local->counters[counter], atomic_load_explicit(&local->counters[counter], memory_order_relaxed) + value, memory_order_relaxed);
+  }
+}
+
+void statsRecord(statsHistogram_t histogram, uint64_t value)
+{
+  statsShard_t *local = shard();
+  atomic_uint_fast64_t *bucket = NULL;
+
+  if(local == NULL)
+  {
+    return;
+  }
+
+  bucket = &local->buckets[histogram][bucketIndex(value)];
+  atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+
+  if(value > atomic_load_explicit(&local->max[histogram], memory_order_relaxed))
+  {
+    atomic_store_explicit(&local->max[histogram], value, memory_order_relaxed);
+  }
+}
+
+/**
+ * snprintf() at @param length into @param buffer, which may already be full
+ * @return the new length
+ */
+static size_t appendf(char *buffer, size_t size, size_t length, const char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  length += vsnprintf(buffer + ((length < size) ? length : size), (length < size) ? size - length : 0, format, args);
+  va_end(args);
+
+  return length;
+}
+
+size_t statsFormat(char *buffer, size_t size)
+{
+  const static double kPercentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+  const int percentileCount = sizeof(kPercentiles) / sizeof(kPercentiles[0]);
+  uint64_t counters[kStatsCounters] = {0};
+  uint64_t max[kStatsHistograms] = {0};
+  uint64_t percentiles[sizeof(kPercentiles) / sizeof(kPercentiles[0])];
+  static uint64_t buckets[kStatsHistograms][STATS_BUCKETS];
+  statsShard_t *cur = NULL;
+  uint64_t count;
+  uint64_t seen;
+  uint64_t value;
+  size_t length = 0;
+  int h, i, p;
+
+  // Only one report is put together at a time, the buckets are too big for
+  // the stack
+  pthread_mutex_lock(&shardsMutex);
+
+  memset(buckets, 0, sizeof(buckets));
+
+  for(cur = shards; cur != NULL; cur = cur->next)
+  {
+    for(i = 0; i < kStatsCounters; i++)
+    {
+      counters[i] += atomic_load_explicit(&cur->counters[i], memory_order_relaxed);
+    }
+
+    for(h = 0; h < kStatsHistograms; h++)
+    {
+      for(i = 0; i < STATS_BUCKETS; i++)
+      {
+        buckets[h][i] += atomic_load_explicit(&cur->buckets[h][i], memory_order_relaxed);
+      }
+
+      value = atomic_load_explicit(&cur->max[h], memory_order_relaxed);
+      max[h] = (value > max[h]) ? value : max[h];
+    }
+  }
+
+  for(i = 0; i < kStatsCounters; i++)
+  {
+    length = appendf(buffer, size, length, "%s %llu\n", kCounterNames[i], (unsigned long long)counters[i]);
+  }
+
+  length = appendf(buffer, size, length, "connections_active %llu\n", (unsigned long long)(counters[kStatsConnectionsAccepted] - counters[kStatsConnectionsClosed]));
+
+  for(h = 0; h < kStatsHistograms; h++)
+  {
+    count = 0;
+
+    for(i = 0; i < STATS_BUCKETS; i++)
+    {
+      count += buckets[h][i];
+    }
+
+    seen = 0;
+    p = 0;
+
+    for(i = 0; i < STATS_BUCKETS && p < percentileCount; i++)
+    {
+      seen += buckets[h][i];
+
+      while(p < percentileCount && count > 0 && seen >= kPercentiles[p] * count)
+      {
+        // A bucket bound can overshoot the largest value actually seen
+        percentiles[p++] = (bucketValue(i) < max[h]) ? bucketValue(i) : max[h];
+      }
+    }
+
+    while(p < percentileCount)
+    {
+      percentiles[p++] = 0;
+    }
+
+    length = appendf(buffer, size, length, "%s count=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu\n", kHistogramNames[h], (unsigned long long)count,
+        (unsigned long long)percentiles[0], (unsigned long long)percentiles[1], (unsigned long long)percentiles[2],
+        (unsigned long long)percentiles[3], (unsigned long long)max[h]);
+  }
+
+  pthread_mutex_unlock(&shardsMutex);
+
+  return length;
+}
+
+void statsDestroy(void)
+{
+  statsShard_t *next = NULL;
+
+  pthread_mutex_lock(&shardsMutex);
+
+  while(shards != NULL)
+  {
+    next = shards->next;
+    free(shards);
+    shards = next;
+  }
+
+  localShard = NULL;
+  pthread_mutex_unlock(&shardsMutex);
+}
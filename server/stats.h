@@ -0,0 +1,80 @@
+/*
+ * stats.h
+ *
+ * Low overhead counters and latency histograms for aesdsocket. Every thread
+ * records into its own shard, so recording never contends; shards are only
+ * summed when somebody asks for a report.
+ */
+
+#ifndef AESD_STATS_H
+#define AESD_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum statsCounter
+{
+  kStatsConnectionsAccepted,
+  kStatsConnectionsClosed,
+  kStatsPackets,
+  kStatsBytesReceived,
+  kStatsBytesSent,
+  kStatsCommits,
+  kStatsCounters
+}statsCounter_t;
+
+typedef enum statsHistogram
+{
+  /**
+   * From the first byte of a packet arriving to the packet being framed, ns
+   */
+  kStatsFrame,
+  /**
+   * Waiting for the store lock, ns
+   */
+  kStatsLockWait,
+  /**
+   * Writing one group commit batch to the store, ns
+   */
+  kStatsAppend,
+  /**
+   * One fdatasync() of the store, ns
+   */
+  kStatsSync,
+  /**
+   * From a response being started to its last byte being sent, ns
+   */
+  kStatsSend,
+  /**
+   * Bytes per response
+   */
+  kStatsResponseSize,
+  kStatsHistograms
+}statsHistogram_t;
+
+/**
+ * @return a monotonic timestamp in nanoseconds
+ */
+uint64_t statsNow(void);
+
+void statsAdd(statsCounter_t counter, uint64_t value);
+
+/**
+ * Adds @param value to @param histogram; values are kept with about 12%
+ * relative precision
+ */
+void statsRecord(statsHistogram_t histogram, uint64_t value);
+
+/**
+ * Writes a text report of every counter and histogram (count, p50, p90,
+ * p99, p99.9, max) summed across threads, truncated to @param size
+ * @return the length of the report, which may exceed @param size
+ */
+size_t statsFormat(char *buffer, size_t size);
+
+/**
+ * Frees the per thread shards once no thread records anymore
+ */
+void statsDestroy(void);
+
+#endif /* AESD_STATS_H */
@@ -0,0 +1,705 @@
+/**
+ * @file store.c
+ * @brief The aesdsocket data store: group commit and published snapshot on
+ *      top of the selected backend
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <string.h>
+#include "store.h"
+#include "storebackend.h"
+#include "logcache.h"
+#include "stats.h"
+
+const static int kMaxBatch = IOV_MAX;
+
+#ifdef USE_AESD_CHAR_DEVICE
+static const storeBackend_t *backend = &storeCharBackend;
+#else
+static const storeBackend_t *backend = &storeFileBackend;
+#endif
+
+// Protects the request queue and the committing flag. The batch itself is
+// written without it; committing makes the leader the only writer, and for
+// backends with exclusive seeks also keeps seeks off its state meanwhile.
+// Readers never take it.
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t committed = PTHREAD_COND_INITIALIZER;
+static bool committing = false;
+static storeRequest_t *pendingHead = NULL;
+static storeRequest_t *pendingTail = NULL;
+static long commitWindow = 0;
+static void (*commitHook)(void) = NULL;
+static storeDurability_t durability = kDurabilityNone;
+// Held by the packet being streamed, whose owner is then the only one to
+// commit; streamed counts the bytes of it already written
+static bool reserved = false;
+static off_t streamed = 0;
+
+// The interval sync thread, stopped by clearing syncRunning under mutex
+static pthread_t syncThread;
+static pthread_cond_t syncStop = PTHREAD_COND_INITIALIZER;
+static bool syncRunning = false;
+static long syncInterval = 0;
+
+// The committed snapshot, published seqlock style: sequence is odd while a
+// commit is being written so storeSnapshot() can retry instead of locking.
+static atomic_uint sequence = 0;
+static atomic_llong committedLength = 0;
+static atomic_ullong committedGeneration = 0;
+static atomic_llong committedBase = 0;
+
+/**
+ * Takes the store lock, recording how long that took when it is contended
+ */
+static void lockStore(void)
+{
+  uint64_t start;
+
+  if(pthread_mutex_trylock(&mutex) == 0)
+  {
+    statsRecord(kStatsLockWait, 0);
+    return;
+  }
+
+  start = statsNow();
+  pthread_mutex_lock(&mutex);
+  statsRecord(kStatsLockWait, statsNow() - start);
+}
+
+/**
+ * Publishes a new committed length after @param evicted bytes were dropped
+ * from the front. Called with mutex held.
+ */
+static void publish(off_t length, off_t evicted)
+{
+  unsigned int seq = atomic_load_explicit(&sequence, memory_order_relaxed);
+
+  atomic_store_explicit(&sequence, seq + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&committedLength, length, memory_order_relaxed);
+  atomic_fetch_add_explicit(&committedGeneration, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&committedBase, evicted, memory_order_relaxed);
+  atomic_store_explicit(&sequence, seq + 2, memory_order_release);
+}
+
+void storeSetCommitHook(void (*hook)(void))
+{
+  commitHook = hook;
+}
+
+void storeSnapshot(storeSnapshot_t *snapshot)
+{
+  unsigned int seq;
+
+  do
+  {
+    seq = atomic_load_explicit(&sequence, memory_order_acquire);
+    snapshot->length = atomic_load_explicit(&committedLength, memory_order_relaxed);
+    snapshot->generation = atomic_load_explicit(&committedGeneration, memory_order_relaxed);
+    snapshot->base = atomic_load_explicit(&committedBase, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+  }while((seq & 1) || seq != atomic_load_explicit(&sequence, memory_order_relaxed));
+}
+
+int storeSetBackend(storeKind_t kind)
+{
+  switch(kind)
+  {
+  case kStoreChar:
+    backend = &storeCharBackend;
+    break;
+  case kStoreFile:
+    backend = &storeFileBackend;
+    break;
+  case kStoreMemory:
+    backend = &storeMemoryBackend;
+    break;
+  default:
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+storeKind_t storeBackend(void)
+{
+  if(backend == &storeCharBackend)
+  {
+    return kStoreChar;
+  }
+
+  return (backend == &storeMemoryBackend) ? kStoreMemory : kStoreFile;
+}
+
+int storeSetRetention(storeRetention_t policy, uint64_t limit)
+{
+  return backend->setRetention(policy, limit);
+}
+
+bool storeSyncing(void)
+{
+  return durability != kDurabilityNone;
+}
+
+int storeOpen(void)
+{
+  off_t length;
+
+  if(backend->open(&length) != 0)
+  {
+    return -1;
+  }
+
+  pthread_mutex_lock(&mutex);
+  publish(length, 0);
+  pthread_mutex_unlock(&mutex);
+
+  return 0;
+}
+
+bool storeWholeCommands(void)
+{
+  return backend->wholeCommands;
+}
+
+ssize_t storePread(void *buffer, size_t count, off_t position)
+{
+  return backend->pread(buffer, count, position);
+}
+
+ssize_t storeSendfile(int outFd, off_t position, size_t count)
+{
+  return backend->sendfile(outFd, position, count);
+}
+
+storePin_t *storePin(off_t position, off_t end)
+{
+  return (backend->pin != NULL && position < end) ? backend->pin(position, end) : NULL;
+}
+
+void storeUnpin(storePin_t *pin)
+{
+  if(pin != NULL)
+  {
+    backend->unpin(pin);
+  }
+}
+
+/**
+ * Syncs the file every syncInterval ms if it was appended to since the last
+ * sync. A failed sync is retried on the next tick.
+ */
+static void *syncLoop(void *threadParam)
+{
+  struct timespec deadline;
+  uint64_t generation;
+  uint64_t synced = atomic_load(&committedGeneration);
+  uint64_t start;
+
+  pthread_mutex_lock(&mutex);
+
+  while(syncRunning)
+  {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (syncInterval % 1000) * 1000000;
+    deadline.tv_sec += syncInterval / 1000 + deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+
+    while(syncRunning && pthread_cond_timedwait(&syncStop, &mutex, &deadline) != ETIMEDOUT);
+
+    generation = atomic_load_explicit(&committedGeneration, memory_order_relaxed);
+
+    if(!syncRunning || generation == synced)
+    {
+      continue;
+    }
+
+    pthread_mutex_unlock(&mutex);
+    start = statsNow();
+
+    if(backend->sync() == 0)
+    {
+      synced = generation;
+    }
+
+    statsRecord(kStatsSync, statsNow() - start);
+    pthread_mutex_lock(&mutex);
+  }
+
+  pthread_mutex_unlock(&mutex);
+
+  return NULL;
+}
+
+int storeSetDurability(storeDurability_t policy, long intervalMs)
+{
+  int result;
+
+  // The driver and the memory ring have nothing to sync
+  if(policy != kDurabilityNone && backend->sync == NULL)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if(policy == kDurabilityInterval)
+  {
+    if(intervalMs <= 0)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+    syncInterval = intervalMs;
+    syncRunning = true;
+    result = pthread_create(&syncThread, NULL, syncLoop, NULL);
+
+    if(result != 0)
+    {
+      syncRunning = false;
+      errno = result;
+      return -1;
+    }
+  }
+
+  durability = policy;
+
+  return 0;
+}
+
+void storeClose(void)
+{
+  pthread_mutex_lock(&mutex);
+
+  if(syncRunning)
+  {
+    syncRunning = false;
+    pthread_cond_signal(&syncStop);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(syncThread, NULL);
+  }
+  else
+  {
+    pthread_mutex_unlock(&mutex);
+  }
+
+  backend->close();
+}
+
+void storeSetCommitWindow(long microseconds)
+{
+  commitWindow = microseconds;
+}
+size_t storeWriteAll(int fd, struct iovec *iov, int count, off_t offset)
+{
+  ssize_t bytes = 0;
+  size_t written = 0;
+
+  while(count > 0)
+  {
+    bytes = (offset == -1) ? writev(fd, iov, count) : pwritev(fd, iov, count, offset + written);
+
+    if(bytes == -1)
+    {
+      if(errno == EINTR)
+      {
+        continue;
+      }
+
+      break;
+    }
+
+    written += bytes;
+
+    while(count > 0 && (size_t)bytes >= iov->iov_len)
+    {
+      bytes -= iov->iov_len;
+      iov++;
+      count--;
+    }
+
+    if(count > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + bytes;
+      iov->iov_len -= bytes;
+    }
+  }
+
+  return written;
+}
+
+/**
+ * Takes up to kMaxBatch queued requests, writes them and completes them.
+ * Called with mutex held and no commit in progress; drops the lock while
+ * waiting for the commit window and while writing.
+ */
+static void commitBatch(void)
+{
+  struct iovec iov[kMaxBatch];
+  struct iovec cacheIov[kMaxBatch];
+  storeRequest_t *batch = NULL;
+  storeRequest_t *request = NULL;
+  storeRequest_t *next = NULL;
+  struct timespec window;
+  storeSnapshot_t snapshot;
+  size_t written = 0;
+  off_t evicted = 0;
+  size_t total = 0;
+  off_t length;
+  off_t prefix;
+  uint64_t start;
+  int result = 0;
+  int count = 0;
+  // Each packet gets its own sync
+  const int batchLimit = (durability == kDurabilityAlways) ? 1 : kMaxBatch;
+
+  committing = true;
+
+  if(commitWindow > 0)
+  {
+    window.tv_sec = commitWindow / 1000000;
+    window.tv_nsec = (commitWindow % 1000000) * 1000;
+    pthread_mutex_unlock(&mutex);
+    nanosleep(&window, NULL);
+    pthread_mutex_lock(&mutex);
+  }
+
+  batch = pendingHead;
+
+  for(request = pendingHead; request != NULL && count < batchLimit; request = request->next)
+  {
+    iov[count].iov_base = (void *)request->data;
+    iov[count].iov_len = request->length;
+    total += request->length;
+    pendingHead = request->next;
+    count++;
+  }
+
+  if(pendingHead == NULL)
+  {
+    pendingTail = NULL;
+  }
+
+  length = atomic_load_explicit(&committedLength, memory_order_relaxed);
+  // The start of the first packet, if storeStream() already wrote it
+  prefix = streamed;
+  streamed = 0;
+
+  pthread_mutex_unlock(&mutex);
+
+  // Appending consumes iov, keep a copy for the response cache
+  memcpy(cacheIov, iov, count * sizeof(struct iovec));
+  start = statsNow();
+  written = backend->append(iov, count, length, &evicted);
+  result = (written < total) ? errno : 0;
+  statsRecord(kStatsAppend, statsNow() - start);
+  statsAdd(kStatsCommits, 1);
+
+  // Nothing in a batch that can't be synced is published, including the
+  // streamed start of its first packet. It is cut off the store so a
+  // restart doesn't pick it up either.
+  if((durability == kDurabilityAlways || durability == kDurabilityGroup) && prefix + written > 0)
+  {
+    start = statsNow();
+
+    if(backend->sync() != 0)
+    {
+      result = errno;
+      written = 0;
+
+      if(backend->discard != NULL)
+      {
+        backend->discard();
+        logcacheUnstage();
+        prefix = 0;
+      }
+    }
+
+    statsRecord(kStatsSync, statsNow() - start);
+  }
+
+  if(backend->appended != NULL)
+  {
+    backend->appended(cacheIov, count, written);
+  }
+
+  length += prefix + written - evicted;
+
+  lockStore();
+
+  if(prefix > 0 || written > 0 || evicted > 0)
+  {
+    logcacheAppend(cacheIov, count, written, evicted, atomic_load_explicit(&committedGeneration, memory_order_relaxed) + 1);
+    publish(length, evicted);
+
+    if(commitHook != NULL)
+    {
+      commitHook();
+    }
+  }
+
+  storeSnapshot(&snapshot);
+
+  // Requests written in full before a failure still succeeded. Each one's
+  // snapshot ends with it, leaving out the requests behind it in the batch.
+  // Once done is set its owner may reuse or free it, so next is read first.
+  for(request = batch; count > 0; request = next, count--)
+  {
+    next = request->next;
+    request->result = (written >= request->length) ? 0 : result;
+    written -= (written >= request->length) ? request->length : written;
+    request->snapshot = snapshot;
+    request->snapshot.length -= ((off_t)written < snapshot.length) ? (off_t)written : snapshot.length;
+    atomic_store_explicit(&request->done, true, memory_order_release);
+  }
+
+  committing = false;
+  pthread_cond_broadcast(&committed);
+}
+
+/**
+ * Adds @param request to the queue, called with mutex held
+ */
+static void enqueue(storeRequest_t *request)
+{
+  request->done = false;
+  request->next = NULL;
+
+  if(pendingTail == NULL)
+  {
+    pendingHead = request;
+  }
+  else
+  {
+    pendingTail->next = request;
+  }
+
+  pendingTail = request;
+}
+
+int storeAppend(const char *data, size_t dataLength, storeSnapshot_t *snapshot)
+{
+  storeRequest_t request;
+
+  request.data = data;
+  request.length = dataLength;
+
+  storeSubmit(&request);
+  storeWait(&request);
+
+  *snapshot = request.snapshot;
+
+  if(request.result != 0)
+  {
+    errno = request.result;
+    return -1;
+  }
+
+  return 0;
+}
+
+void storeSubmit(storeRequest_t *request)
+{
+  lockStore();
+  enqueue(request);
+  pthread_mutex_unlock(&mutex);
+}
+
+void storeWait(storeRequest_t *request)
+{
+  lockStore();
+
+  while(!request->done)
+  {
+    if(committing || reserved)
+    {
+      pthread_cond_wait(&committed, &mutex);
+    }
+    else
+    {
+      commitBatch();
+    }
+  }
+
+  pthread_mutex_unlock(&mutex);
+}
+
+void storeCommit(void)
+{
+  lockStore();
+
+  while(!reserved && (committing || pendingHead != NULL))
+  {
+    if(committing)
+    {
+      pthread_cond_wait(&committed, &mutex);
+    }
+    else
+    {
+      commitBatch();
+    }
+  }
+
+  pthread_mutex_unlock(&mutex);
+}
+
+int storeReserve(void)
+{
+  if(backend->stream == NULL)
+  {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  lockStore();
+
+  while(committing)
+  {
+    pthread_cond_wait(&committed, &mutex);
+  }
+
+  if(reserved)
+  {
+    pthread_mutex_unlock(&mutex);
+    errno = EAGAIN;
+    return -1;
+  }
+
+  reserved = true;
+  streamed = 0;
+  pthread_mutex_unlock(&mutex);
+
+  return 0;
+}
+
+int storeStream(const char *data, size_t length)
+{
+  off_t evicted = 0;
+  size_t written;
+  int error;
+
+  written = backend->stream(data, length, &evicted);
+  error = errno;
+
+  // Dropping old data to make room takes effect right away
+  if(evicted > 0)
+  {
+    lockStore();
+    logcacheAppend(NULL, 0, 0, evicted, atomic_load_explicit(&committedGeneration, memory_order_relaxed) + 1);
+    publish(atomic_load_explicit(&committedLength, memory_order_relaxed) - evicted, evicted);
+    pthread_mutex_unlock(&mutex);
+  }
+
+  // Only starting the packet evicts, so nothing is staged before this
+  logcacheStage(data, written);
+  streamed += written;
+
+  if(written < length)
+  {
+    errno = error;
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Gives the reservation up and commits everything queued behind it. Called
+ * with mutex held by the reservation's owner.
+ */
+static void unreserve(void)
+{
+  reserved = false;
+
+  while(pendingHead != NULL)
+  {
+    commitBatch();
+  }
+
+  pthread_cond_broadcast(&committed);
+}
+
+int storeRelease(const char *data, size_t length, storeSnapshot_t *snapshot)
+{
+  storeRequest_t request;
+
+  request.data = data;
+  request.length = length;
+
+  lockStore();
+
+  // Written first so it lands right behind the streamed part
+  request.done = false;
+  request.next = pendingHead;
+  pendingHead = &request;
+
+  if(pendingTail == NULL)
+  {
+    pendingTail = &request;
+  }
+
+  unreserve();
+  pthread_mutex_unlock(&mutex);
+
+  *snapshot = request.snapshot;
+
+  if(request.result != 0)
+  {
+    errno = request.result;
+    return -1;
+  }
+
+  return 0;
+}
+
+void storeAbandon(void)
+{
+  storeSnapshot_t snapshot;
+
+  if(backend->discard == NULL)
+  {
+    storeRelease("\n", 1, &snapshot);
+    return;
+  }
+
+  lockStore();
+  backend->discard();
+  logcacheUnstage();
+  streamed = 0;
+  unreserve();
+  pthread_mutex_unlock(&mutex);
+}
+
+int storeSeekTo(uint32_t writeCmd, uint32_t writeCmdOffset, off_t *position, storeSnapshot_t *snapshot)
+{
+  int result;
+
+  if(!backend->exclusiveSeeks)
+  {
+    storeSnapshot(snapshot);
+    return backend->seekTo(writeCmd, writeCmdOffset, snapshot, position);
+  }
+
+  lockStore();
+
+  while(committing)
+  {
+    pthread_cond_wait(&committed, &mutex);
+  }
+
+  // Taken before unlocking so a later eviction can't shift the position
+  storeSnapshot(snapshot);
+  result = backend->seekTo(writeCmd, writeCmdOffset, snapshot, position);
+  pthread_mutex_unlock(&mutex);
+
+  return result;
+}
@@ -0,0 +1,303 @@
+/*
+ * store.h
+ *
+ * The aesdsocket data store: the aesdchar driver, flat files or memory,
+ * picked at startup and accessed with explicit offsets so connections never
+ * share a file position. The backends are in storechar.c, storefile.c and
+ * storememory.c.
+ */
+
+#ifndef AESD_STORE_H
+#define AESD_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+// Makes the driver the default backend
+#define USE_AESD_CHAR_DEVICE 1
+
+/**
+ * Where the store keeps its data, see storeSetBackend()
+ */
+typedef enum storeKind
+{
+  /**
+   * /dev/aesdchar, which keeps only its last writes
+   */
+  kStoreChar,
+  /**
+   * /var/tmp/aesdsocketdata and its later segments, removed on close
+   */
+  kStoreFile,
+  /**
+   * A ring in memory, by default of 64 MiB, that needs no kernel module
+   */
+  kStoreMemory
+}storeKind_t;
+
+/**
+ * When appended data is forced to disk with fdatasync(), file mode only
+ */
+typedef enum storeDurability
+{
+  /**
+   * Never, the kernel writes back whenever it likes
+   */
+  kDurabilityNone,
+  /**
+   * Every packet is written and synced on its own before it is acked
+   */
+  kDurabilityAlways,
+  /**
+   * A background thread syncs every interval if anything was appended
+   */
+  kDurabilityInterval,
+  /**
+   * One sync covers each group commit batch, acked together afterwards
+   */
+  kDurabilityGroup
+}storeDurability_t;
+
+/**
+ * How much of the file store is kept, see storeSetRetention()
+ */
+typedef enum storeRetention
+{
+  kRetainAll,
+  kRetainBytes,
+  kRetainPackets
+}storeRetention_t;
+
+/**
+ * A consistent view of the committed store. Bytes in [0, length) are fully
+ * written and, in file and memory mode, never change again, so readers can
+ * stream them without any lock while appends carry on. Store offsets shift
+ * whenever the oldest data is dropped; base + offset is a logical position
+ * that stays put.
+ */
+typedef struct storeSnapshot
+{
+  /**
+   * Incremented by every committed append
+   */
+  uint64_t generation;
+  /**
+   * Committed length of the store
+   */
+  off_t length;
+  /**
+   * Bytes discarded from the front of the store so far
+   */
+  off_t base;
+}storeSnapshot_t;
+
+/**
+ * One queued append. Requests queued by any thread are written together by
+ * whichever caller commits next, in a single writev(), in queue order.
+ */
+typedef struct storeRequest
+{
+  const char *data;
+  size_t length;
+  /**
+   * 0 on success or the errno of the failed write, valid once done is set
+   */
+  int result;
+  /**
+   * Committed state up to the end of this request, without any requests
+   * behind it in the same batch, valid once done is set
+   */
+  storeSnapshot_t snapshot;
+  /**
+   * Set by the commit leader; may be polled without the store lock
+   */
+  atomic_bool done;
+  struct storeRequest *next;
+}storeRequest_t;
+
+/**
+ * Selects the backend, the driver if USE_AESD_CHAR_DEVICE is defined and
+ * the file store otherwise by default. Call before anything else.
+ * @return 0 on success, -1 with errno set on failure
+ */
+int storeSetBackend(storeKind_t kind);
+
+storeKind_t storeBackend(void);
+
+/**
+ * Bounds the store to the most recent @param limit bytes or packets, the
+ * way the driver keeps only its last writes. The file log is split into
+ * segments of about a quarter of the limit each; once a new segment is
+ * started, the oldest ones are deleted whole while the rest still cover the
+ * limit. The memory ring drops whole packets and is never unbounded. Call
+ * before storeOpen().
+ * @return 0 on success, -1 with errno set on failure
+ */
+int storeSetRetention(storeRetention_t policy, uint64_t limit);
+
+/**
+ * Opens (creating if needed) the store and records its current length. In
+ * file mode every segment left by an earlier run is picked up again.
+ * @return 0 on success, -1 with errno set on failure
+ */
+int storeOpen(void);
+
+/**
+ * Selects the durability policy, @param intervalMs is only used by
+ * kDurabilityInterval. Only the file store has anything to sync. Call
+ * after storeOpen() and before appending; the interval thread inherits the
+ * caller's signal mask.
+ * @return 0 on success, -1 with errno set on failure
+ */
+int storeSetDurability(storeDurability_t policy, long intervalMs);
+
+/**
+ * Closes the store; in file mode the segment files are removed as well
+ */
+void storeClose(void);
+
+/**
+ * @return true if appends must end with a newline. The driver keeps a write
+ *      without one to itself until the rest of its write command arrives,
+ *      so it can't be counted as stored; the other backends take any bytes.
+ */
+bool storeWholeCommands(void);
+
+/**
+ * Reads up to @param count committed bytes from logical @param position,
+ * see storeSnapshot_t. Reads stop at the end of a file segment.
+ * @return the number of bytes read, or -1 with errno set on failure; ENODATA
+ *      if the position has already been dropped
+ */
+ssize_t storePread(void *buffer, size_t count, off_t position);
+
+/**
+ * sendfile()s up to @param count committed bytes from logical @param
+ * position to @param outFd, stopping at the end of a file segment. The
+ * driver and the memory ring send() from a buffer instead, so outFd must
+ * be a socket.
+ * @return the number of bytes sent, or -1 with errno set as by storePread()
+ *      and sendfile()
+ */
+ssize_t storeSendfile(int outFd, off_t position, size_t count);
+
+/**
+ * What storePin() holds on to, private to the backend
+ */
+typedef struct storePin storePin_t;
+
+/**
+ * Keeps committed logical [@param position, @param end) readable by
+ * storePread() and storeSendfile() until storeUnpin(), even if retention
+ * drops it meanwhile. For a response sent in several calls, which could
+ * otherwise be cut short by a roll between them.
+ * @return the pin, or NULL if nothing needed pinning or it failed; reads
+ *      then fail with ENODATA once the range is dropped, as before
+ */
+storePin_t *storePin(off_t position, off_t end);
+
+/**
+ * Lets the range of @param pin, which may be NULL, be dropped
+ */
+void storeUnpin(storePin_t *pin);
+
+/**
+ * Appends @param length bytes of @param data and waits for it to be
+ * committed. Concurrent callers are group committed: the first one to find
+ * no commit in progress writes everything queued so far in one writev() and
+ * wakes the others. Appends are serialized with each other, never with
+ * readers.
+ * @param snapshot set to the committed state that includes this append
+ * @return 0 on success, -1 with errno set on failure
+ */
+int storeAppend(const char *data, size_t length, storeSnapshot_t *snapshot);
+
+/**
+ * Queues @param request without waiting for it. The data must stay valid
+ * until request->done is set by a later storeCommit() or storeAppend().
+ */
+void storeSubmit(storeRequest_t *request);
+
+/**
+ * Waits for @param request, queued by storeSubmit(), to be committed,
+ * committing it and everything queued before it itself unless another
+ * caller already is. Returns with request->done set.
+ */
+void storeWait(storeRequest_t *request);
+
+/**
+ * Commits every request queued so far, returning once all are done. While
+ * a streamed packet holds the append reservation it returns right away and
+ * leaves them queued; storeRelease() commits them.
+ */
+void storeCommit(void);
+
+/**
+ * Takes the append reservation for a packet too long to buffer whole, so it
+ * can be written with storeStream() as it arrives without anything else
+ * landing in the middle of it. Meanwhile other appends stay queued, so the
+ * owner must give it up with storeAbandon() if the rest of the packet
+ * doesn't come. Only the driver and the file store can take one.
+ * @return 0 on success, -1 with errno set on failure; EAGAIN if another
+ *      packet holds the reservation
+ */
+int storeReserve(void);
+
+/**
+ * Writes the next @param length bytes of the reserved packet. Nothing of it
+ * is published before storeRelease().
+ * @return 0 on success, -1 with errno set on failure
+ */
+int storeStream(const char *data, size_t length);
+
+/**
+ * Writes the last @param length bytes of the reserved packet, publishes all
+ * of it, gives the reservation up and commits what was queued meanwhile.
+ * The response cache takes the packet whole, having kept what was streamed,
+ * or is disabled if the packet didn't fit in the buffer budget.
+ * @param snapshot set to the committed state that includes the packet
+ * @return 0 on success, -1 with errno set on failure
+ */
+int storeRelease(const char *data, size_t length, storeSnapshot_t *snapshot);
+
+/**
+ * Gives the reservation up without finishing the packet. The file store
+ * drops what was streamed; the driver can't, so the packet is ended there.
+ */
+void storeAbandon(void);
+
+/**
+ * Sets how long a commit leader waits for more requests to join its batch
+ * before writing, 0 (the default) to write immediately.
+ */
+void storeSetCommitWindow(long microseconds);
+
+/**
+ * Registers @param hook to be called by the commit leader right after each
+ * new snapshot is published, with the append lock held, so it must be quick
+ * and must not append. Set it before any other thread appends.
+ */
+void storeSetCommitHook(void (*hook)(void));
+
+/**
+ * Reads the committed state without taking the append lock
+ */
+void storeSnapshot(storeSnapshot_t *snapshot);
+
+/**
+ * Translates a (write command, offset within the command) pair into an
+ * absolute store offset, as AESDCHAR_IOCSEEKTO does, without leaving any
+ * state behind on the shared descriptor. In file mode the write commands
+ * are looked up in a sidecar index of packet end offsets kept next to each
+ * segment (<segment>.idx), mapped at startup and extended on every commit;
+ * the memory ring keeps the same packet ends in memory.
+ * @param position set to the resulting offset
+ * @param snapshot set to the committed state the position refers to
+ * @return 0 on success, -1 with errno set on failure
+ */
+int storeSeekTo(uint32_t writeCmd, uint32_t writeCmdOffset, off_t *position, storeSnapshot_t *snapshot);
+
+#endif /* AESD_STORE_H */
@@ -0,0 +1,115 @@
+/*
+ * storebackend.h
+ *
+ * What the aesdsocket data store needs from the place it keeps its bytes.
+ * Private to store.c and the backends (storechar.c, storefile.c,
+ * storememory.c); everything else goes through store.h. The group commit,
+ * the published snapshot and the durability policy are shared and live in
+ * store.c.
+ */
+
+#ifndef AESD_STOREBACKEND_H
+#define AESD_STOREBACKEND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "store.h"
+
+/**
+ * Offsets are store offsets, positions are logical ones, see
+ * storeSnapshot_t. Only the commit leader appends; reads and seeks run on
+ * any thread alongside it.
+ */
+typedef struct storeBackend
+{
+  const char *name;
+  /**
+   * See storeSetRetention(); refuses what the backend can't honour
+   */
+  int (*setRetention)(storeRetention_t policy, uint64_t limit);
+  /**
+   * @param length set to what the store already holds
+   * @return 0 on success, -1 with errno set on failure
+   */
+  int (*open)(off_t *length);
+  void (*close)(void);
+  /**
+   * Writes the @param count buffers of @param iov (consuming it) after the
+   * @param length bytes already committed, first dropping old data if
+   * retention calls for it.
+   * @param evicted set to the bytes dropped from the front of the store
+   * @return the bytes written; fewer than asked for with errno set on failure
+   */
+  size_t (*append)(struct iovec *iov, int count, off_t length, off_t *evicted);
+  /**
+   * Writes @param length bytes of a packet whose end hasn't arrived yet,
+   * behind what is committed and what was streamed of it before. The next
+   * append carries on the same packet. NULL if the backend can only keep
+   * packets in memory anyway.
+   * @param evicted set as by append when this starts the packet
+   * @return the bytes written; fewer than asked for with errno set on failure
+   */
+  size_t (*stream)(const char *data, size_t length, off_t *evicted);
+  /**
+   * Forgets what was written past the committed length: the streamed part
+   * of an unfinished packet and any append that isn't going to be
+   * published. NULL if it can't be taken back.
+   */
+  void (*discard)(void);
+  /**
+   * Takes note of the packets among the first @param written bytes of
+   * @param iov, the first of them after any streamed part, once they are
+   * going to be published. May be NULL.
+   */
+  void (*appended)(const struct iovec *iov, int count, size_t written);
+  /**
+   * fdatasync()s what has been appended. NULL if there is nothing that
+   * could be synced, which limits the store to kDurabilityNone.
+   * @return 0 on success, -1 with errno set on failure
+   */
+  int (*sync)(void);
+  ssize_t (*pread)(void *buffer, size_t count, off_t position);
+  ssize_t (*sendfile)(int outFd, off_t position, size_t count);
+  /**
+   * See storePin(). NULL if positions are never dropped while they are
+   * being read.
+   */
+  storePin_t *(*pin)(off_t position, off_t end);
+  void (*unpin)(storePin_t *pin);
+  /**
+   * Gives the store offset @param writeCmdOffset bytes into write command
+   * @param writeCmd as of @param snapshot, see storeSeekTo()
+   * @return 0 on success, -1 with errno set on failure
+   */
+  int (*seekTo)(uint32_t writeCmd, uint32_t writeCmdOffset, const storeSnapshot_t *snapshot, off_t *position);
+  /**
+   * Set when seeking moves state that appends rely on, the driver's file
+   * position; seeks are then serialized with commits
+   */
+  bool exclusiveSeeks;
+  /**
+   * Set when every append must end with a newline, see storeWholeCommands()
+   */
+  bool wholeCommands;
+}storeBackend_t;
+
+extern const storeBackend_t storeCharBackend;
+extern const storeBackend_t storeFileBackend;
+extern const storeBackend_t storeMemoryBackend;
+
+/**
+ * @return true if the durability policy syncs appended data at all
+ */
+bool storeSyncing(void);
+
+/**
+ * Writes all of @param count buffers of @param iov to @param fd, at
+ * @param offset or, when it is -1, at the file position, resuming after
+ * short writes. Consumes iov.
+ * @return the number of bytes written; less than requested on failure
+ */
+size_t storeWriteAll(int fd, struct iovec *iov, int count, off_t offset);
+
+#endif /* AESD_STOREBACKEND_H */
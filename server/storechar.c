@@ -0,0 +1,181 @@
+/**
+ * @file storechar.c
+ * @brief Store backend on the aesdchar driver, which keeps its last writes
+ *      in kernel memory
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "storebackend.h"
+#include "../aesd-char-driver/aesd_ioctl.h"
+
+const static char *kCharDevice = "/dev/aesdchar";
+const static int kSendChunkLength = 16384;
+
+static int fd = -1;
+// Bytes of an unfinished packet the driver is holding on to
+static off_t streamedLength = 0;
+
+static int charSetRetention(storeRetention_t policy, uint64_t limit)
+{
+  // The driver already keeps only its last writes
+  if(policy != kRetainAll)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int charOpen(off_t *length)
+{
+  int error;
+
+  fd = open(kCharDevice, O_RDWR | O_CREAT | O_CLOEXEC, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
+
+  if(fd == -1)
+  {
+    return -1;
+  }
+
+  *length = lseek(fd, 0, SEEK_END);
+
+  if(*length == -1)
+  {
+    error = errno;
+    close(fd);
+    fd = -1;
+    errno = error;
+    return -1;
+  }
+
+  return 0;
+}
+
+static void charClose(void)
+{
+  if(fd != -1)
+  {
+    close(fd);
+    fd = -1;
+  }
+}
+
+static size_t charAppend(struct iovec *iov, int count, off_t length, off_t *evicted)
+{
+  size_t written = storeWriteAll(fd, iov, count, -1);
+  int error = errno;
+  off_t prefix = streamedLength;
+  off_t end;
+
+  *evicted = 0;
+  streamedLength = 0;
+
+  // The driver drops its oldest entries once the ring is full, so ask it
+  end = lseek(fd, 0, SEEK_END);
+
+  if(end == -1)
+  {
+    return 0;
+  }
+
+  if(length + prefix + (off_t)written > end)
+  {
+    *evicted = length + prefix + written - end;
+  }
+
+  errno = error;
+
+  return written;
+}
+
+/**
+ * The driver keeps a write without a newline to itself until the rest of
+ * the command arrives
+ */
+static size_t charStream(const char *data, size_t length, off_t *evicted)
+{
+  struct iovec iov = { (void *)data, length };
+  size_t written = storeWriteAll(fd, &iov, 1, -1);
+
+  *evicted = 0;
+  streamedLength += written;
+
+  return written;
+}
+
+static ssize_t charPread(void *buffer, size_t count, off_t position)
+{
+  storeSnapshot_t snapshot;
+
+  storeSnapshot(&snapshot);
+
+  return pread(fd, buffer, count, position - snapshot.base);
+}
+
+/**
+ * The driver can't splice, so sendfile() can't read from it either; each
+ * call bounces one chunk through the stack
+ */
+static ssize_t charSendfile(int outFd, off_t position, size_t count)
+{
+  char chunk[kSendChunkLength];
+  ssize_t bytes = charPread(chunk, (count < sizeof(chunk)) ? count : sizeof(chunk), position);
+
+  if(bytes <= 0)
+  {
+    return bytes;
+  }
+
+  return send(outFd, chunk, bytes, MSG_NOSIGNAL);
+}
+
+/**
+ * Runs with no commit in progress: the ioctl moves the shared file position,
+ * which is put back at the end for the next append
+ */
+static int charSeekTo(uint32_t writeCmd, uint32_t writeCmdOffset, const storeSnapshot_t *snapshot, off_t *position)
+{
+  struct aesd_seekto seekto;
+
+  seekto.write_cmd = writeCmd;
+  seekto.write_cmd_offset = writeCmdOffset;
+
+  if(ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto) != 0)
+  {
+    return -1;
+  }
+
+  *position = lseek(fd, 0, SEEK_CUR);
+
+  if(*position == -1 || lseek(fd, 0, SEEK_END) == -1)
+  {
+    return -1;
+  }
+
+  return 0;
+}
+
+const storeBackend_t storeCharBackend =
+{
+  .name = "char",
+  .setRetention = charSetRetention,
+  .open = charOpen,
+  .close = charClose,
+  .append = charAppend,
+  .stream = charStream,
+  .discard = NULL,
+  .appended = NULL,
+  .sync = NULL,
+  .pread = charPread,
+  .sendfile = charSendfile,
+  .seekTo = charSeekTo,
+  .exclusiveSeeks = true,
+  .wholeCommands = true
+};
@@ -0,0 +1,1059 @@
+/**
+ * @file storefile.c
+ * @brief Store backend on flat files: a log split into segments, each with
+ *      a mapped index of its packets
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include "queue.h"
+#include "storebackend.h"
+
+const static char *kSocketData = "/var/tmp/aesdsocketdata";
+const static int kScanChunkLength = 4096;
+const static int kSegmentsPerLimit = 4;
+const static off_t kMaxOffset = INT64_MAX;
+const static char kIndexSuffix[] = ".idx";
+const static size_t kIndexMinEntries = 1024;
+
+/**
+ * One file of the log. Only the last segment is ever appended to, and
+ * segments are deleted whole once retention no longer needs them.
+ */
+typedef struct storeSegment
+{
+  TAILQ_ENTRY(storeSegment) entries;
+  int fd;
+  unsigned int sequence;
+  /**
+   * Logical position of the first byte, see storeSnapshot_t
+   */
+  off_t start;
+  /**
+   * Only changed by the commit leader while the segment is the last one
+   */
+  off_t length;
+  /**
+   * Packets in the segment; index entries below it are valid
+   */
+  atomic_size_t packets;
+  /**
+   * The sidecar index, mapped: the end offset within the segment of each
+   * packet. Only remapped with the write lock held.
+   */
+  int indexFd;
+  uint64_t *index;
+  size_t indexCapacity;
+  /**
+   * One for the segment list plus one per reader using it or response
+   * pinning it, see filePin()
+   */
+  atomic_int refs;
+  /**
+   * Set once dropped from the segment list while still referenced; it then
+   * sits in the retired list until the last reference goes
+   */
+  bool retired;
+}storeSegment_t;
+
+struct storePin
+{
+  int count;
+  storeSegment_t *segments[];
+};
+
+// Only the commit leader adds and drops segments, with the write lock held;
+// readers look segments up and take a reference with the read lock held.
+static TAILQ_HEAD(segmentList, storeSegment) segments = TAILQ_HEAD_INITIALIZER(segments);
+// Dropped segments that responses still need; these hold no list reference
+static struct segmentList retired = TAILQ_HEAD_INITIALIZER(retired);
+static pthread_rwlock_t segmentsLock = PTHREAD_RWLOCK_INITIALIZER;
+static storeSegment_t *active = NULL;
+static storeRetention_t retention = kRetainAll;
+// Bytes of an unfinished packet written past the end of the active segment,
+// and the write commands indexed in them
+static off_t streamedLength = 0;
+static size_t streamedPackets = 0;
+static uint64_t retentionLimit = 0;
+// Cleared if any index can't be kept up to date; seeks then scan instead
+static atomic_bool indexed = false;
+
+static int fileSetRetention(storeRetention_t policy, uint64_t limit)
+{
+  if(policy != kRetainAll && limit == 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  retention = policy;
+  retentionLimit = limit;
+
+  return 0;
+}
+
+/**
+ * Names the file of segment @param sequence, or its index with @param
+ * suffix
+ */
+static void segmentPath(unsigned int sequence, const char *suffix, char *path, size_t size)
+{
+  // The first segment keeps the name the store always had
+  if(sequence == 0)
+  {
+    snprintf(path, size, "%s%s", kSocketData, suffix);
+  }
+  else
+  {
+    snprintf(path, size, "%s.%u%s", kSocketData, sequence, suffix);
+  }
+}
+
+/**
+ * @return how much of the retention limit @param segment uses
+ */
+static uint64_t segmentUnits(const storeSegment_t *segment)
+{
+  return (retention == kRetainPackets) ? atomic_load_explicit(&segment->packets, memory_order_relaxed) : (uint64_t)segment->length;
+}
+
+static void indexClose(storeSegment_t *segment)
+{
+  if(segment->index != NULL)
+  {
+    munmap(segment->index, segment->indexCapacity * sizeof(uint64_t));
+    segment->index = NULL;
+    segment->indexCapacity = 0;
+  }
+
+  if(segment->indexFd != -1)
+  {
+    close(segment->indexFd);
+    segment->indexFd = -1;
+  }
+}
+
+/**
+ * Doubles the room in the index of @param segment
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int indexGrow(storeSegment_t *segment)
+{
+  size_t capacity = segment->indexCapacity * 2;
+  void *index = NULL;
+
+  if(ftruncate(segment->indexFd, capacity * sizeof(uint64_t)) != 0)
+  {
+    return -1;
+  }
+
+  // Seeks read the index with the read lock held
+  pthread_rwlock_wrlock(&segmentsLock);
+  index = mremap(segment->index, segment->indexCapacity * sizeof(uint64_t), capacity * sizeof(uint64_t), MREMAP_MAYMOVE);
+
+  if(index != MAP_FAILED)
+  {
+    segment->index = index;
+    segment->indexCapacity = capacity;
+  }
+
+  pthread_rwlock_unlock(&segmentsLock);
+
+  return (index == MAP_FAILED) ? -1 : 0;
+}
+
+/**
+ * Records a packet of @param segment ending at offset @param end. Called
+ * by the commit leader before the packet is published.
+ */
+static void indexAppend(storeSegment_t *segment, uint64_t end)
+{
+  size_t packets = atomic_load_explicit(&segment->packets, memory_order_relaxed);
+
+  if(segment->index != NULL && packets == segment->indexCapacity && indexGrow(segment) != 0)
+  {
+    atomic_store(&indexed, false);
+  }
+
+  if(segment->index != NULL && packets < segment->indexCapacity)
+  {
+    segment->index[packets] = end;
+  }
+
+  atomic_store_explicit(&segment->packets, packets + 1, memory_order_release);
+}
+
+/**
+ * Indexes every write command @param length bytes of @param data end,
+ * given they are written at offset @param offset of the active segment
+ * @return the number of commands indexed
+ */
+static size_t indexLines(const char *data, size_t length, off_t offset)
+{
+  const char *line = data;
+  const char *newline = NULL;
+  size_t lines = 0;
+
+  while((newline = memchr(line, '\n', length - (line - data))) != NULL)
+  {
+    line = newline + 1;
+    indexAppend(active, offset + (line - data));
+    lines++;
+  }
+
+  return lines;
+}
+
+/**
+ * Indexes the packets of @param segment from offset @param from on by
+ * scanning for their newlines
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int segmentScan(storeSegment_t *segment, off_t from)
+{
+  char buffer[kScanChunkLength];
+  off_t scan = from;
+  ssize_t bytes;
+  ssize_t i;
+
+  while(scan < segment->length)
+  {
+    bytes = pread(segment->fd, buffer, (segment->length - scan < kScanChunkLength) ? segment->length - scan : kScanChunkLength, scan);
+
+    if(bytes == -1 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if(bytes <= 0)
+    {
+      errno = (bytes == 0) ? EIO : errno;
+      return -1;
+    }
+
+    for(i = 0; i < bytes; i++)
+    {
+      if(buffer[i] == '\n')
+      {
+        indexAppend(segment, scan + i + 1);
+      }
+    }
+
+    scan += bytes;
+  }
+
+  return 0;
+}
+
+/**
+ * Maps the index of @param segment, creating it if needed. The data file is
+ * what counts: entries past its end are discarded, and packets past the last
+ * entry, e.g. written just before a crash, are indexed by scanning only that
+ * tail, so the index itself never needs syncing.
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int indexOpen(storeSegment_t *segment)
+{
+  char path[PATH_MAX];
+  struct stat st;
+  uint64_t end = 0;
+  size_t count = 0;
+  void *index = NULL;
+
+  segmentPath(segment->sequence, kIndexSuffix, path, sizeof(path));
+  segment->indexFd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
+
+  if(segment->indexFd == -1 || fstat(segment->indexFd, &st) != 0)
+  {
+    return -1;
+  }
+
+  segment->indexCapacity = st.st_size / sizeof(uint64_t);
+
+  if(segment->indexCapacity < kIndexMinEntries)
+  {
+    segment->indexCapacity = kIndexMinEntries;
+
+    if(ftruncate(segment->indexFd, segment->indexCapacity * sizeof(uint64_t)) != 0)
+    {
+      return -1;
+    }
+  }
+
+  index = mmap(NULL, segment->indexCapacity * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, segment->indexFd, 0);
+
+  if(index == MAP_FAILED)
+  {
+    return -1;
+  }
+
+  segment->index = index;
+
+  // Ends only grow, so the first one that doesn't, or that lies past the
+  // data, is where the valid entries stop; clear the rest so a later run
+  // can't mistake stale entries for new ones
+  while(count < segment->indexCapacity && segment->index[count] > end && segment->index[count] <= (uint64_t)segment->length)
+  {
+    end = segment->index[count++];
+  }
+
+  memset(segment->index + count, 0, (segment->indexCapacity - count) * sizeof(uint64_t));
+  atomic_store(&segment->packets, count);
+
+  return segmentScan(segment, end);
+}
+
+/**
+ * Opens (creating if needed) segment @param sequence, whose first byte is
+ * at logical position @param start
+ * @return the segment holding the list's reference, or NULL with errno set
+ */
+static storeSegment_t *segmentOpen(unsigned int sequence, off_t start)
+{
+  char path[PATH_MAX];
+  storeSegment_t *segment = calloc(1, sizeof(storeSegment_t));
+  int error;
+
+  if(segment == NULL)
+  {
+    return NULL;
+  }
+
+  segmentPath(sequence, "", path, sizeof(path));
+  segment->sequence = sequence;
+  segment->start = start;
+  segment->indexFd = -1;
+  atomic_init(&segment->packets, 0);
+  atomic_init(&segment->refs, 1);
+  segment->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
+
+  if(segment->fd == -1)
+  {
+    free(segment);
+    return NULL;
+  }
+
+  segment->length = lseek(segment->fd, 0, SEEK_END);
+
+  if(segment->length != -1 && indexOpen(segment) != 0)
+  {
+    // Still count the packets, retention may need them
+    atomic_store(&indexed, false);
+    indexClose(segment);
+    atomic_store(&segment->packets, 0);
+    segment->length = (segmentScan(segment, 0) == 0) ? segment->length : -1;
+  }
+
+  if(segment->length == -1)
+  {
+    error = errno;
+    indexClose(segment);
+    close(segment->fd);
+    free(segment);
+    errno = error;
+    return NULL;
+  }
+
+  return segment;
+}
+
+static void segmentFree(storeSegment_t *segment)
+{
+  indexClose(segment);
+  close(segment->fd);
+  free(segment);
+}
+
+/**
+ * Drops a reference on @param segment; called without the lock held
+ */
+static void segmentRelease(storeSegment_t *segment)
+{
+  if(atomic_fetch_sub_explicit(&segment->refs, 1, memory_order_acq_rel) == 1)
+  {
+    // Nothing can take a new reference on it any more, see segmentRetain()
+    if(segment->retired)
+    {
+      pthread_rwlock_wrlock(&segmentsLock);
+      TAILQ_REMOVE(&retired, segment, entries);
+      pthread_rwlock_unlock(&segmentsLock);
+    }
+
+    segmentFree(segment);
+  }
+}
+
+/**
+ * Takes a reference on @param segment with the lock held, unless it is
+ * retired and its last reference is already gone
+ * @return true if the reference was taken
+ */
+static bool segmentRetain(storeSegment_t *segment)
+{
+  int refs = atomic_load_explicit(&segment->refs, memory_order_relaxed);
+
+  do
+  {
+    if(refs == 0)
+    {
+      return false;
+    }
+  }while(!atomic_compare_exchange_weak_explicit(&segment->refs, &refs, refs + 1, memory_order_relaxed, memory_order_relaxed));
+
+  return true;
+}
+
+/**
+ * Deletes the files of @param segment, which is no longer in the list
+ */
+static void segmentUnlink(const storeSegment_t *segment)
+{
+  char path[PATH_MAX];
+
+  segmentPath(segment->sequence, "", path, sizeof(path));
+  unlink(path);
+  segmentPath(segment->sequence, kIndexSuffix, path, sizeof(path));
+  unlink(path);
+}
+
+/**
+ * Takes a reference on the segment holding logical @param position
+ * @param available set to the bytes left in the segment from there, or
+ *      kMaxOffset for the last segment, which is still growing
+ * @return the segment, or NULL with errno set to ENODATA if the position
+ *      has been dropped
+ */
+static storeSegment_t *segmentAcquire(off_t position, off_t *available)
+{
+  storeSegment_t *segment = NULL;
+
+  pthread_rwlock_rdlock(&segmentsLock);
+
+  TAILQ_FOREACH_REVERSE(segment, &segments, segmentList, entries)
+  {
+    if(segment->start <= position)
+    {
+      break;
+    }
+  }
+
+  if(segment != NULL)
+  {
+    atomic_fetch_add_explicit(&segment->refs, 1, memory_order_relaxed);
+    *available = (TAILQ_NEXT(segment, entries) != NULL) ? segment->start + segment->length - position : kMaxOffset;
+  }
+  else
+  {
+    // Dropped already, but maybe still pinned by the response asking
+    TAILQ_FOREACH(segment, &retired, entries)
+    {
+      if(segment->start <= position && position < segment->start + segment->length && segmentRetain(segment))
+      {
+        *available = segment->start + segment->length - position;
+        break;
+      }
+    }
+  }
+
+  pthread_rwlock_unlock(&segmentsLock);
+
+  if(segment == NULL)
+  {
+    errno = ENODATA;
+  }
+
+  return segment;
+}
+
+static int compareSequence(const void *a, const void *b)
+{
+  unsigned int left = *(const unsigned int *)a;
+  unsigned int right = *(const unsigned int *)b;
+
+  return (left > right) - (left < right);
+}
+
+/**
+ * Collects the sequence numbers of the segment files in the store's
+ * directory, in order
+ * @return the number found, or -1 with errno set on failure
+ */
+static ssize_t segmentsFind(unsigned int **sequences)
+{
+  char directory[PATH_MAX];
+  const char *name = strrchr(kSocketData, '/') + 1;
+  size_t nameLength = strlen(name);
+  unsigned int *grown = NULL;
+  struct dirent *entry = NULL;
+  DIR *dir = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  char *end = NULL;
+  unsigned long sequence;
+
+  *sequences = NULL;
+  snprintf(directory, sizeof(directory), "%.*s", (int)(name - kSocketData), kSocketData);
+  dir = opendir(directory);
+
+  if(dir == NULL)
+  {
+    return -1;
+  }
+
+  while((entry = readdir(dir)) != NULL)
+  {
+    if(strncmp(entry->d_name, name, nameLength) != 0)
+    {
+      continue;
+    }
+
+    if(entry->d_name[nameLength] == '\0')
+    {
+      sequence = 0;
+    }
+    else if(entry->d_name[nameLength] == '.')
+    {
+      errno = 0;
+      sequence = strtoul(entry->d_name + nameLength + 1, &end, 10);
+
+      if(errno != 0 || *end != '\0' || sequence == 0 || sequence > UINT_MAX)
+      {
+        continue;
+      }
+    }
+    else
+    {
+      continue;
+    }
+
+    if(count == capacity)
+    {
+      capacity = (capacity == 0) ? 16 : capacity * 2;
+      grown = realloc(*sequences, capacity * sizeof(unsigned int));
+
+      if(grown == NULL)
+      {
+        free(*sequences);
+        *sequences = NULL;
+        closedir(dir);
+        return -1;
+      }
+
+      *sequences = grown;
+    }
+
+    (*sequences)[count++] = sequence;
+  }
+
+  closedir(dir);
+  qsort(*sequences, count, sizeof(unsigned int), compareSequence);
+
+  return count;
+}
+
+/**
+ * Opens every segment an earlier run left behind, or a fresh first one
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int segmentsOpen(void)
+{
+  unsigned int *sequences = NULL;
+  storeSegment_t *segment = NULL;
+  ssize_t count;
+  ssize_t i;
+  off_t start = 0;
+
+  count = segmentsFind(&sequences);
+
+  if(count == -1)
+  {
+    return -1;
+  }
+
+  for(i = 0; i < count || (count == 0 && i == 0); i++)
+  {
+    segment = segmentOpen((count == 0) ? 0 : sequences[i], start);
+
+    if(segment == NULL)
+    {
+      free(sequences);
+      return -1;
+    }
+
+    TAILQ_INSERT_TAIL(&segments, segment, entries);
+    start += segment->length;
+  }
+
+  free(sequences);
+  active = TAILQ_LAST(&segments, segmentList);
+
+  return 0;
+}
+
+/**
+ * Closes every segment, deleting its file
+ */
+static void segmentsClose(void)
+{
+  storeSegment_t *segment = NULL;
+
+  while((segment = TAILQ_FIRST(&segments)) != NULL)
+  {
+    TAILQ_REMOVE(&segments, segment, entries);
+    segmentUnlink(segment);
+    segmentRelease(segment);
+  }
+
+  active = NULL;
+}
+
+/**
+ * @return false while @param segment ends in the middle of a write command,
+ *      which starting a new segment would split; true if there is no index
+ *      to tell
+ */
+static bool segmentComplete(const storeSegment_t *segment)
+{
+  size_t packets = atomic_load_explicit(&segment->packets, memory_order_relaxed);
+
+  if(segment->index == NULL || packets > segment->indexCapacity)
+  {
+    return true;
+  }
+
+  return (packets > 0) ? segment->index[packets - 1] == (uint64_t)segment->length : segment->length == 0;
+}
+
+/**
+ * Starts a new segment once the last one holds its share of the retention
+ * limit, then drops the oldest segments while the others still cover the
+ * limit. Called by the commit leader before writing, without mutex held.
+ * @return the number of bytes dropped from the front of the store
+ */
+static off_t segmentRoll(void)
+{
+  storeSegment_t *segment = NULL;
+  storeSegment_t *oldest = NULL;
+  uint64_t retained = 0;
+  off_t evicted = 0;
+
+  if(retention == kRetainAll || segmentUnits(active) < (retentionLimit + kSegmentsPerLimit - 1) / kSegmentsPerLimit || !segmentComplete(active))
+  {
+    return 0;
+  }
+
+  // The sync thread only looks after the last segment
+  if(storeSyncing())
+  {
+    fdatasync(active->fd);
+  }
+
+  // On failure keep appending to the current segment and retry next batch
+  segment = segmentOpen(active->sequence + 1, active->start + active->length);
+
+  if(segment == NULL)
+  {
+    return 0;
+  }
+
+  TAILQ_FOREACH(oldest, &segments, entries)
+  {
+    retained += segmentUnits(oldest);
+  }
+
+  pthread_rwlock_wrlock(&segmentsLock);
+
+  TAILQ_INSERT_TAIL(&segments, segment, entries);
+  active = segment;
+
+  while((oldest = TAILQ_FIRST(&segments)) != active && retained - segmentUnits(oldest) >= retentionLimit)
+  {
+    TAILQ_REMOVE(&segments, oldest, entries);
+    retained -= segmentUnits(oldest);
+    evicted += oldest->length;
+    segmentUnlink(oldest);
+    // Readers still sending from it keep it open, and responses pinning it
+    // findable, until they are done
+    oldest->retired = true;
+    TAILQ_INSERT_TAIL(&retired, oldest, entries);
+
+    if(atomic_fetch_sub_explicit(&oldest->refs, 1, memory_order_acq_rel) == 1)
+    {
+      TAILQ_REMOVE(&retired, oldest, entries);
+      segmentFree(oldest);
+    }
+  }
+
+  pthread_rwlock_unlock(&segmentsLock);
+
+  return evicted;
+}
+
+static int fileOpen(off_t *length)
+{
+  storeSegment_t *segment = NULL;
+
+  atomic_store(&indexed, true);
+
+  if(segmentsOpen() != 0)
+  {
+    segmentsClose();
+    return -1;
+  }
+
+  *length = 0;
+
+  TAILQ_FOREACH(segment, &segments, entries)
+  {
+    *length += segment->length;
+  }
+
+  return 0;
+}
+
+static void fileClose(void)
+{
+  segmentsClose();
+}
+
+static size_t fileAppend(struct iovec *iov, int count, off_t length, off_t *evicted)
+{
+  // A packet is never split across segments
+  *evicted = (streamedLength == 0) ? segmentRoll() : 0;
+
+  return storeWriteAll(active->fd, iov, count, active->length + streamedLength);
+}
+
+static size_t fileStream(const char *data, size_t length, off_t *evicted)
+{
+  struct iovec iov = { (void *)data, length };
+  size_t written;
+
+  *evicted = (streamedLength == 0) ? segmentRoll() : 0;
+  written = storeWriteAll(active->fd, &iov, 1, active->length + streamedLength);
+  // Seeks only see the commands once a snapshot includes them
+  streamedPackets += indexLines(data, written, active->length + streamedLength);
+  streamedLength += written;
+
+  return written;
+}
+
+/**
+ * Cuts the segment back to its committed length so a restart doesn't pick
+ * up an unfinished packet or a batch that failed to sync
+ */
+static void fileDiscard(void)
+{
+  if(ftruncate(active->fd, active->length) != 0)
+  {
+    // Overwritten by the next append anyway
+  }
+
+  atomic_fetch_sub_explicit(&active->packets, streamedPackets, memory_order_relaxed);
+  streamedLength = 0;
+  streamedPackets = 0;
+}
+
+/**
+ * Indexes every write command, i.e. every newline, written before
+ * publishing makes it seekable. The driver and a restart count them the
+ * same way, whatever packets they came in.
+ */
+static void fileAppended(const struct iovec *iov, int count, size_t written)
+{
+  off_t offset = active->length + streamedLength;
+  size_t length;
+  int i;
+
+  for(i = 0; i < count && written > 0; i++)
+  {
+    length = (iov[i].iov_len < written) ? iov[i].iov_len : written;
+    indexLines(iov[i].iov_base, length, offset);
+    offset += length;
+    written -= length;
+  }
+
+  active->length = offset;
+  streamedLength = 0;
+  streamedPackets = 0;
+}
+
+/**
+ * fdatasync()s the segment being appended to, also from the interval sync
+ * thread while the leader may be rolling over to a new one
+ */
+static int fileSync(void)
+{
+  storeSegment_t *segment = NULL;
+  off_t available;
+  int result;
+
+  // Every position past its start is in the last segment
+  segment = segmentAcquire(kMaxOffset, &available);
+
+  if(segment == NULL)
+  {
+    return -1;
+  }
+
+  result = fdatasync(segment->fd);
+  segmentRelease(segment);
+
+  return result;
+}
+
+static ssize_t filePread(void *buffer, size_t count, off_t position)
+{
+  storeSegment_t *segment = NULL;
+  off_t available;
+  ssize_t bytes;
+  int error;
+
+  segment = segmentAcquire(position, &available);
+
+  if(segment == NULL)
+  {
+    return -1;
+  }
+
+  bytes = pread(segment->fd, buffer, ((off_t)count < available) ? count : (size_t)available, position - segment->start);
+  error = errno;
+  segmentRelease(segment);
+  errno = error;
+
+  return bytes;
+}
+
+static ssize_t fileSendfile(int outFd, off_t position, size_t count)
+{
+  storeSegment_t *segment = NULL;
+  off_t available;
+  off_t offset;
+  ssize_t bytes;
+  int error;
+
+  segment = segmentAcquire(position, &available);
+
+  if(segment == NULL)
+  {
+    return -1;
+  }
+
+  offset = position - segment->start;
+  bytes = sendfile(outFd, segment->fd, &offset, ((off_t)count < available) ? count : (size_t)available);
+  error = errno;
+  segmentRelease(segment);
+  errno = error;
+
+  return bytes;
+}
+
+/**
+ * @return true if @param segment holds part of logical [@param position,
+ *      @param end); called with the lock held
+ */
+static bool segmentOverlaps(const storeSegment_t *segment, off_t position, off_t end)
+{
+  // The last segment may still be growing, but holds anything committed
+  return segment->start < end && (TAILQ_NEXT(segment, entries) == NULL || position < segment->start + segment->length);
+}
+
+/**
+ * Takes a reference on every listed segment holding part of the range so a
+ * roll can't drop it from under the response sending it; dropped segments
+ * stay findable in the retired list while referenced
+ */
+static storePin_t *filePin(off_t position, off_t end)
+{
+  storeSegment_t *segment = NULL;
+  storePin_t *pin = NULL;
+  int count = 0;
+
+  pthread_rwlock_rdlock(&segmentsLock);
+
+  TAILQ_FOREACH(segment, &segments, entries)
+  {
+    count += segmentOverlaps(segment, position, end);
+  }
+
+  pin = malloc(sizeof(*pin) + count * sizeof(pin->segments[0]));
+
+  if(pin != NULL)
+  {
+    pin->count = 0;
+
+    TAILQ_FOREACH(segment, &segments, entries)
+    {
+      if(segmentOverlaps(segment, position, end))
+      {
+        atomic_fetch_add_explicit(&segment->refs, 1, memory_order_relaxed);
+        pin->segments[pin->count++] = segment;
+      }
+    }
+  }
+
+  pthread_rwlock_unlock(&segmentsLock);
+
+  return pin;
+}
+
+static void fileUnpin(storePin_t *pin)
+{
+  int i;
+
+  for(i = 0; i < pin->count; i++)
+  {
+    segmentRelease(pin->segments[i]);
+  }
+
+  free(pin);
+}
+
+/**
+ * Looks write command @param writeCmd up in the segment indexes and gives
+ * where it starts and ends in the store as of @param snapshot
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int indexFind(uint32_t writeCmd, const storeSnapshot_t *snapshot, off_t *entryStart, off_t *entryEnd)
+{
+  storeSegment_t *segment = NULL;
+  size_t packets;
+  int result = -1;
+
+  pthread_rwlock_rdlock(&segmentsLock);
+
+  TAILQ_FOREACH(segment, &segments, entries)
+  {
+    packets = atomic_load_explicit(&segment->packets, memory_order_acquire);
+
+    if(writeCmd < packets)
+    {
+      *entryStart = segment->start + ((writeCmd > 0) ? segment->index[writeCmd - 1] : 0) - snapshot->base;
+      *entryEnd = segment->start + segment->index[writeCmd] - snapshot->base;
+      // The leader may have indexed packets the snapshot doesn't include yet
+      result = (*entryStart >= 0 && *entryEnd <= snapshot->length) ? 0 : -1;
+      break;
+    }
+
+    writeCmd -= packets;
+  }
+
+  pthread_rwlock_unlock(&segmentsLock);
+
+  if(result != 0)
+  {
+    errno = EINVAL;
+  }
+
+  return result;
+}
+
+/**
+ * Finds where write command @param writeCmd starts and ends in the store as
+ * of @param snapshot by counting newlines, for when the indexes are off
+ * @return 0 on success, -1 with errno set on failure
+ */
+static int findEntry(uint32_t writeCmd, const storeSnapshot_t *snapshot, off_t *entryStart, off_t *entryEnd)
+{
+  char buffer[kScanChunkLength];
+  off_t length = snapshot->length;
+  off_t scan = 0;
+  ssize_t bytes = 0;
+  ssize_t i;
+
+  *entryStart = 0;
+
+  while(scan < length)
+  {
+    bytes = filePread(buffer, (length - scan < kScanChunkLength) ? length - scan : kScanChunkLength, snapshot->base + scan);
+
+    if(bytes == -1 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if(bytes <= 0)
+    {
+      errno = (bytes == 0) ? EIO : errno;
+      return -1;
+    }
+
+    for(i = 0; i < bytes; i++)
+    {
+      if(buffer[i] != '\n')
+      {
+        continue;
+      }
+
+      if(writeCmd == 0)
+      {
+        *entryEnd = scan + i + 1;
+        return 0;
+      }
+
+      writeCmd--;
+      *entryStart = scan + i + 1;
+    }
+
+    scan += bytes;
+  }
+
+  errno = EINVAL;
+  return -1;
+}
+
+/**
+ * Committed bytes never change in a file, so seeks need no store lock
+ */
+static int fileSeekTo(uint32_t writeCmd, uint32_t writeCmdOffset, const storeSnapshot_t *snapshot, off_t *position)
+{
+  off_t entryStart;
+  off_t entryEnd;
+
+  if(atomic_load(&indexed) ? indexFind(writeCmd, snapshot, &entryStart, &entryEnd) != 0 : findEntry(writeCmd, snapshot, &entryStart, &entryEnd) != 0)
+  {
+    return -1;
+  }
+
+  if(writeCmdOffset >= entryEnd - entryStart)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *position = entryStart + writeCmdOffset;
+
+  return 0;
+}
+
+const storeBackend_t storeFileBackend =
+{
+  .name = "file",
+  .setRetention = fileSetRetention,
+  .open = fileOpen,
+  .close = fileClose,
+  .append = fileAppend,
+  .stream = fileStream,
+  .discard = fileDiscard,
+  .appended = fileAppended,
+  .sync = fileSync,
+  .pread = filePread,
+  .sendfile = fileSendfile,
+  .pin = filePin,
+  .unpin = fileUnpin,
+  .seekTo = fileSeekTo,
+  .exclusiveSeeks = false,
+  .wholeCommands = false
+};
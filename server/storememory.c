@@ -0,0 +1,316 @@
+/**
+ * @file storememory.c
+ * @brief Store backend kept in memory only
+ *
+ * The bytes themselves live in the response cache (logcache.c), which every
+ * commit extends anyway and which readers share without locking. This
+ * backend bounds it like a ring, dropping whole write commands (lines) from
+ * the front to make room for each batch, and remembers where they end for
+ * seeks. It reserves the cache's room for a batch up front, so running out
+ * of memory fails that batch alone instead of losing the cache and
+ * everything in it.
+ * Nothing survives a restart.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "storebackend.h"
+#include "logcache.h"
+
+// What the ring holds when no retention limit is given
+const static uint64_t kDefaultLimit = 64 * 1024 * 1024;
+const static size_t kMinPackets = 1024;
+
+// Protects the packet ring; taken by the commit leader and by seeks
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+// Logical end positions of the retained write commands, count of them
+// starting at ends[first] in a ring of capacity entries
+static uint64_t *ends = NULL;
+static size_t capacity = 0;
+static size_t first = 0;
+static size_t count = 0;
+// Logical positions of the first retained byte and of the end of the data
+static uint64_t start = 0;
+static uint64_t end = 0;
+static storeRetention_t retention = kRetainBytes;
+static uint64_t retentionLimit = kDefaultLimit;
+
+static int memorySetRetention(storeRetention_t policy, uint64_t limit)
+{
+  if(policy != kRetainAll && limit == 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // Memory is always bounded
+  retention = (policy == kRetainAll) ? kRetainBytes : policy;
+  retentionLimit = (policy == kRetainAll) ? kDefaultLimit : limit;
+
+  return 0;
+}
+
+static int memoryOpen(off_t *length)
+{
+  ends = malloc(kMinPackets * sizeof(uint64_t));
+
+  if(ends == NULL)
+  {
+    return -1;
+  }
+
+  capacity = kMinPackets;
+  first = 0;
+  count = 0;
+  start = 0;
+  end = 0;
+  *length = 0;
+
+  return 0;
+}
+
+static void memoryClose(void)
+{
+  free(ends);
+  ends = NULL;
+  capacity = 0;
+  count = 0;
+}
+
+static size_t countLines(const char *data, size_t length)
+{
+  const char *line = data;
+  size_t lines = 0;
+
+  while((line = memchr(line, '\n', data + length - line)) != NULL)
+  {
+    line++;
+    lines++;
+  }
+
+  return lines;
+}
+
+/**
+ * @return true if @param bytes more bytes in @param packets more commands
+ *      would exceed the retention limit
+ */
+static bool memoryFull(uint64_t bytes, size_t packets)
+{
+  if(retention == kRetainPackets)
+  {
+    return count + packets > retentionLimit;
+  }
+
+  return end - start + bytes > retentionLimit;
+}
+
+/**
+ * The cache takes the bytes once the batch is published, this only makes
+ * room for them; nothing is dropped for a batch that fails
+ */
+static size_t memoryAppend(struct iovec *iov, int iovCount, off_t length, off_t *evicted)
+{
+  uint64_t total = 0;
+  uint64_t oldStart = start;
+  size_t lines = 0;
+  int i;
+
+  *evicted = 0;
+
+  for(i = 0; i < iovCount; i++)
+  {
+    total += iov[i].iov_len;
+    lines += (retention == kRetainPackets) ? countLines(iov[i].iov_base, iov[i].iov_len) : 0;
+  }
+
+  if(logcacheReserve(total) != 0)
+  {
+    return 0;
+  }
+
+  pthread_mutex_lock(&mutex);
+
+  while(count > 0 && memoryFull(total, lines))
+  {
+    start = ends[first];
+    first = (first + 1) % capacity;
+    count--;
+  }
+
+  pthread_mutex_unlock(&mutex);
+
+  *evicted = start - oldStart;
+
+  return total;
+}
+
+/**
+ * Doubles the packet ring, unwrapping it. Called with mutex held.
+ * @return 0 on success, -1 if it couldn't be grown
+ */
+static int memoryGrow(void)
+{
+  uint64_t *grown = malloc(capacity * 2 * sizeof(uint64_t));
+  size_t i;
+
+  if(grown == NULL)
+  {
+    return -1;
+  }
+
+  for(i = 0; i < count; i++)
+  {
+    grown[i] = ends[(first + i) % capacity];
+  }
+
+  free(ends);
+  ends = grown;
+  capacity *= 2;
+  first = 0;
+
+  return 0;
+}
+
+/**
+ * Records where each write command, i.e. each newline, written ends, the
+ * way the driver counts them whatever packets they came in
+ */
+static void memoryAppended(const struct iovec *iov, int iovCount, size_t written)
+{
+  const char *data = NULL;
+  const char *line = NULL;
+  size_t length;
+  int i;
+
+  pthread_mutex_lock(&mutex);
+
+  for(i = 0; i < iovCount && written > 0; i++)
+  {
+    data = iov[i].iov_base;
+    length = (iov[i].iov_len < written) ? iov[i].iov_len : written;
+
+    for(line = data; (line = memchr(line, '\n', data + length - line)) != NULL; )
+    {
+      line++;
+
+      // A command that can't be recorded stays part of the one after it
+      if(count < capacity || memoryGrow() == 0)
+      {
+        ends[(first + count) % capacity] = end + (line - data);
+        count++;
+      }
+    }
+
+    end += length;
+    written -= length;
+  }
+
+  pthread_mutex_unlock(&mutex);
+}
+
+static ssize_t memoryPread(void *buffer, size_t length, off_t position)
+{
+  logcacheView_t view;
+  off_t offset;
+
+  if(logcacheAcquire(&view) != 0)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  offset = position - view.base;
+
+  if(offset < 0)
+  {
+    logcacheRelease(&view);
+    errno = ENODATA;
+    return -1;
+  }
+
+  length = (offset >= view.length) ? 0 : ((off_t)length < view.length - offset) ? length : (size_t)(view.length - offset);
+  memcpy(buffer, view.data + offset, length);
+  logcacheRelease(&view);
+
+  return length;
+}
+
+static ssize_t memorySendfile(int outFd, off_t position, size_t length)
+{
+  logcacheView_t view;
+  off_t offset;
+  ssize_t bytes;
+  int error;
+
+  if(logcacheAcquire(&view) != 0)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  offset = position - view.base;
+
+  if(offset < 0 || offset >= view.length)
+  {
+    logcacheRelease(&view);
+    errno = (offset < 0) ? ENODATA : 0;
+    return (offset < 0) ? -1 : 0;
+  }
+
+  bytes = send(outFd, view.data + offset, ((off_t)length < view.length - offset) ? length : (size_t)(view.length - offset), MSG_NOSIGNAL);
+  error = errno;
+  logcacheRelease(&view);
+  errno = error;
+
+  return bytes;
+}
+
+static int memorySeekTo(uint32_t writeCmd, uint32_t writeCmdOffset, const storeSnapshot_t *snapshot, off_t *position)
+{
+  off_t entryStart = -1;
+  off_t entryEnd = -1;
+
+  pthread_mutex_lock(&mutex);
+
+  if(writeCmd < count)
+  {
+    entryStart = ((writeCmd > 0) ? ends[(first + writeCmd - 1) % capacity] : start) - snapshot->base;
+    entryEnd = ends[(first + writeCmd) % capacity] - snapshot->base;
+  }
+
+  pthread_mutex_unlock(&mutex);
+
+  // The leader may have recorded packets the snapshot doesn't include yet,
+  // or dropped ones it still does
+  if(entryStart < 0 || entryEnd > snapshot->length || writeCmdOffset >= entryEnd - entryStart)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *position = entryStart + writeCmdOffset;
+
+  return 0;
+}
+
+const storeBackend_t storeMemoryBackend =
+{
+  .name = "memory",
+  .setRetention = memorySetRetention,
+  .open = memoryOpen,
+  .close = memoryClose,
+  .append = memoryAppend,
+  .stream = NULL,
+  .discard = NULL,
+  .appended = memoryAppended,
+  .sync = NULL,
+  .pread = memoryPread,
+  .sendfile = memorySendfile,
+  .seekTo = memorySeekTo,
+  .exclusiveSeeks = false,
+  .wholeCommands = false
+};
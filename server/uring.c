@@ -0,0 +1,253 @@
+/**
+ * @file uring.c
+ * @brief io_uring rings driven through the raw system calls
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+static int uringSetup(unsigned int entries, struct io_uring_params *params)
+{
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int fd, unsigned int submit, unsigned int wait, unsigned int flags, const sigset_t *sigmask)
+{
+  return syscall(__NR_io_uring_enter, fd, submit, wait, flags, sigmask, _NSIG / 8);
+}
+
+static int uringRegister(int fd, unsigned int opcode, const void *arg, unsigned int count)
+{
+  return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+/**
+ * @return the submissions queued since the kernel last consumed any
+ */
+static unsigned int uringQueued(uring_t *ring)
+{
+  return *ring->sqTail - atomic_load_explicit((_Atomic unsigned int *)ring->sqHead, memory_order_acquire);
+}
+
+static void uringFilesInit(uring_t *ring, unsigned int files)
+{
+  int *table = malloc(files * sizeof(int));
+  unsigned int i;
+
+  ring->freeFiles = malloc(files * sizeof(int));
+
+  if(table == NULL || ring->freeFiles == NULL)
+  {
+    free(table);
+    free(ring->freeFiles);
+    ring->freeFiles = NULL;
+    return;
+  }
+
+  // Every slot starts empty and is filled as connections come in
+  for(i = 0; i < files; i++)
+  {
+    table[i] = -1;
+  }
+
+  if(uringRegister(ring->fd, IORING_REGISTER_FILES, table, files) == 0)
+  {
+    for(i = 0; i < files; i++)
+    {
+      ring->freeFiles[i] = files - 1 - i;
+    }
+
+    ring->freeFileCount = files;
+  }
+
+  free(table);
+}
+
+int uringInit(uring_t *ring, unsigned int entries, unsigned int files)
+{
+  struct io_uring_params params;
+  int error;
+
+  memset(ring, 0, sizeof(uring_t));
+  memset(&params, 0, sizeof(params));
+
+  // Only the owning thread submits, so completions needn't interrupt it
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+  ring->fd = uringSetup(entries, &params);
+
+  if(ring->fd == -1 && errno == EINVAL)
+  {
+    memset(&params, 0, sizeof(params));
+    ring->fd = uringSetup(entries, &params);
+  }
+
+  if(ring->fd == -1)
+  {
+    return -1;
+  }
+
+  ring->entries = params.sq_entries;
+  ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+  if(ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED)
+  {
+    error = errno;
+    uringDestroy(ring);
+    errno = error;
+    return -1;
+  }
+
+  ring->sqHead = (unsigned int *)((char *)ring->sqRing + params.sq_off.head);
+  ring->sqTail = (unsigned int *)((char *)ring->sqRing + params.sq_off.tail);
+  ring->sqMask = (unsigned int *)((char *)ring->sqRing + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned int *)((char *)ring->sqRing + params.sq_off.array);
+  ring->cqHead = (unsigned int *)((char *)ring->cqRing + params.cq_off.head);
+  ring->cqTail = (unsigned int *)((char *)ring->cqRing + params.cq_off.tail);
+  ring->cqMask = (unsigned int *)((char *)ring->cqRing + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)((char *)ring->cqRing + params.cq_off.cqes);
+
+  if(files > 0)
+  {
+    uringFilesInit(ring, files);
+  }
+
+  return 0;
+}
+
+void uringDestroy(uring_t *ring)
+{
+  if(ring->sqes != NULL && ring->sqes != MAP_FAILED)
+  {
+    munmap(ring->sqes, ring->sqesSize);
+  }
+
+  if(ring->cqRing != NULL && ring->cqRing != MAP_FAILED)
+  {
+    munmap(ring->cqRing, ring->cqRingSize);
+  }
+
+  if(ring->sqRing != NULL && ring->sqRing != MAP_FAILED)
+  {
+    munmap(ring->sqRing, ring->sqRingSize);
+  }
+
+  // Closing the ring cancels whatever is still in flight
+  if(ring->fd != -1)
+  {
+    close(ring->fd);
+  }
+
+  free(ring->freeFiles);
+  memset(ring, 0, sizeof(uring_t));
+  ring->fd = -1;
+}
+
+int uringPrep(uring_t *ring, uint8_t opcode, int fd, int file, const void *addr, unsigned int length, uint32_t flags, uint64_t userData)
+{
+  struct io_uring_sqe *sqe = NULL;
+  unsigned int tail = *ring->sqTail;
+  unsigned int index;
+
+  if(uringQueued(ring) == ring->entries && uringEnter(ring->fd, ring->entries, 0, 0, NULL) == -1)
+  {
+    return -1;
+  }
+
+  if(uringQueued(ring) == ring->entries)
+  {
+    errno = EBUSY;
+    return -1;
+  }
+
+  index = tail & *ring->sqMask;
+  sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+  sqe->opcode = opcode;
+  sqe->fd = (file != -1) ? file : fd;
+  sqe->flags = (file != -1) ? IOSQE_FIXED_FILE : 0;
+  sqe->addr = (uintptr_t)addr;
+  sqe->len = length;
+  sqe->rw_flags = flags;
+  sqe->user_data = userData;
+
+  ring->sqArray[index] = index;
+  atomic_store_explicit((_Atomic unsigned int *)ring->sqTail, tail + 1, memory_order_release);
+
+  return 0;
+}
+
+int uringWait(uring_t *ring, const sigset_t *sigmask)
+{
+  return (uringEnter(ring->fd, uringQueued(ring), 1, IORING_ENTER_GETEVENTS, sigmask) == -1) ? -1 : 0;
+}
+
+struct io_uring_cqe *uringPeek(uring_t *ring)
+{
+  unsigned int head = *ring->cqHead;
+
+  if(head == atomic_load_explicit((_Atomic unsigned int *)ring->cqTail, memory_order_acquire))
+  {
+    return NULL;
+  }
+
+  return &ring->cqes[head & *ring->cqMask];
+}
+
+void uringSeen(uring_t *ring)
+{
+  atomic_store_explicit((_Atomic unsigned int *)ring->cqHead, *ring->cqHead + 1, memory_order_release);
+}
+
+int uringFileAdd(uring_t *ring, int fd)
+{
+  struct io_uring_files_update update;
+  int file;
+
+  if(ring->freeFileCount == 0)
+  {
+    return -1;
+  }
+
+  file = ring->freeFiles[ring->freeFileCount - 1];
+  memset(&update, 0, sizeof(update));
+  update.offset = file;
+  update.fds = (uintptr_t)&fd;
+
+  if(uringRegister(ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) != 1)
+  {
+    return -1;
+  }
+
+  ring->freeFileCount--;
+
+  return file;
+}
+
+void uringFileRemove(uring_t *ring, int file)
+{
+  struct io_uring_files_update update;
+  int fd = -1;
+
+  memset(&update, 0, sizeof(update));
+  update.offset = file;
+  update.fds = (uintptr_t)&fd;
+
+  if(uringRegister(ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1)
+  {
+    ring->freeFiles[ring->freeFileCount++] = file;
+  }
+}
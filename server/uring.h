@@ -0,0 +1,89 @@
+/*
+ * uring.h
+ *
+ * Minimal io_uring wrapper for the aesdsocket reactors, made directly on
+ * the system calls so nothing beyond the kernel headers is needed. A ring
+ * belongs to the thread that created it and is never shared.
+ */
+
+#ifndef AESD_URING_H
+#define AESD_URING_H
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+typedef struct uring
+{
+  int fd;
+  unsigned int entries;
+  unsigned int *sqHead;
+  unsigned int *sqTail;
+  unsigned int *sqMask;
+  unsigned int *sqArray;
+  struct io_uring_sqe *sqes;
+  unsigned int *cqHead;
+  unsigned int *cqTail;
+  unsigned int *cqMask;
+  struct io_uring_cqe *cqes;
+  void *sqRing;
+  size_t sqRingSize;
+  void *cqRing;
+  size_t cqRingSize;
+  size_t sqesSize;
+  /**
+   * Free slots of the registered file table, used as a stack
+   */
+  int *freeFiles;
+  int freeFileCount;
+}uring_t;
+
+/**
+ * Sets up a ring with room for @param entries submissions and a sparse
+ * table of @param files registered files. The ring works without the file
+ * table if the kernel refuses it.
+ * @return 0 on success, -1 with errno set on failure
+ */
+int uringInit(uring_t *ring, unsigned int entries, unsigned int files);
+
+void uringDestroy(uring_t *ring);
+
+/**
+ * Queues an operation on @param fd, or on registered slot @param file
+ * unless it is -1. @param flags goes into the opcode's flags field
+ * (msg_flags, poll32_events, ...). Submits what is queued first when the
+ * submission queue is full.
+ * @return 0 on success, -1 with errno set on failure
+ */
+int uringPrep(uring_t *ring, uint8_t opcode, int fd, int file, const void *addr, unsigned int length, uint32_t flags, uint64_t userData);
+
+/**
+ * Submits everything queued and waits for at least one completion with
+ * @param sigmask (may be NULL) installed.
+ * @return 0 on success, -1 with errno set on failure
+ */
+int uringWait(uring_t *ring, const sigset_t *sigmask);
+
+/**
+ * @return the oldest unconsumed completion, or NULL if there is none
+ */
+struct io_uring_cqe *uringPeek(uring_t *ring);
+
+/**
+ * Hands the completion returned by uringPeek() back to the kernel
+ */
+void uringSeen(uring_t *ring);
+
+/**
+ * Registers @param fd in a free slot of the file table
+ * @return the slot, or -1 if none is free
+ */
+int uringFileAdd(uring_t *ring, int fd);
+
+/**
+ * Unregisters the file in @param file. Nothing may be in flight on it.
+ */
+void uringFileRemove(uring_t *ring, int file);
+
+#endif /* AESD_URING_H */
@@ -0,0 +1,93 @@
+/**
+ * @file workqueue.c
+ * @brief Bounded, blocking work queue used by the aesdsocket worker pool
+ */
+
+#include <stdlib.h>
+#include "workqueue.h"
+
+int workqueueInit(workqueue_t *queue, int capacity)
+{
+  queue->items = calloc(capacity, sizeof(void *));
+
+  if(queue->items == NULL)
+  {
+    return -1;
+  }
+
+  queue->capacity = capacity;
+  queue->head = 0;
+  queue->count = 0;
+  queue->stopped = false;
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->notEmpty, NULL);
+  pthread_cond_init(&queue->notFull, NULL);
+
+  return 0;
+}
+
+void workqueueDestroy(workqueue_t *queue)
+{
+  pthread_cond_destroy(&queue->notFull);
+  pthread_cond_destroy(&queue->notEmpty);
+  pthread_mutex_destroy(&queue->mutex);
+  free(queue->items);
+  queue->items = NULL;
+}
+
+bool workqueuePush(workqueue_t *queue, void *item)
+{
+  pthread_mutex_lock(&queue->mutex);
+
+  while(queue->count == queue->capacity && !queue->stopped)
+  {
+    pthread_cond_wait(&queue->notFull, &queue->mutex);
+  }
+
+  if(queue->stopped)
+  {
+    pthread_mutex_unlock(&queue->mutex);
+    return false;
+  }
+
+  queue->items[(queue->head + queue->count) % queue->capacity] = item;
+  queue->count++;
+
+  pthread_cond_signal(&queue->notEmpty);
+  pthread_mutex_unlock(&queue->mutex);
+
+  return true;
+}
+
+void *workqueuePop(workqueue_t *queue)
+{
+  void *item = NULL;
+
+  pthread_mutex_lock(&queue->mutex);
+
+  while(queue->count == 0 && !queue->stopped)
+  {
+    pthread_cond_wait(&queue->notEmpty, &queue->mutex);
+  }
+
+  if(!queue->stopped)
+  {
+    item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_cond_signal(&queue->notFull);
+  }
+
+  pthread_mutex_unlock(&queue->mutex);
+
+  return item;
+}
+
+void workqueueStop(workqueue_t *queue)
+{
+  pthread_mutex_lock(&queue->mutex);
+  queue->stopped = true;
+  pthread_cond_broadcast(&queue->notEmpty);
+  pthread_cond_broadcast(&queue->notFull);
+  pthread_mutex_unlock(&queue->mutex);
+}
@@ -0,0 +1,51 @@
+/*
+ * workqueue.h
+ *
+ * Bounded FIFO of pointers handed from the aesdsocket reactor to its pool of
+ * worker threads.
+ */
+
+#ifndef AESD_WORKQUEUE_H
+#define AESD_WORKQUEUE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+typedef struct workqueue
+{
+  void **items;
+  int capacity;
+  int head;
+  int count;
+  bool stopped;
+  pthread_mutex_t mutex;
+  pthread_cond_t notEmpty;
+  pthread_cond_t notFull;
+}workqueue_t;
+
+/**
+ * @return 0 on success, -1 if the item array could not be allocated
+ */
+int workqueueInit(workqueue_t *queue, int capacity);
+
+void workqueueDestroy(workqueue_t *queue);
+
+/**
+ * Queues @param item, waiting for room while the queue is full.
+ * @return false if the queue has been stopped
+ */
+bool workqueuePush(workqueue_t *queue, void *item);
+
+/**
+ * Waits for the next item.
+ * @return the oldest item, or NULL once the queue has been stopped
+ */
+void *workqueuePop(workqueue_t *queue);
+
+/**
+ * Wakes every thread blocked in workqueuePush()/workqueuePop() and makes
+ * both fail from now on.
+ */
+void workqueueStop(workqueue_t *queue);
+
+#endif /* AESD_WORKQUEUE_H */